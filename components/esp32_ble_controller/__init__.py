@@ -5,6 +5,7 @@ import esphome.config_validation as cv
 from esphome.automation import LambdaAction
 from esphome.const import CONF_ID, CONF_TRIGGER_ID, CONF_FORMAT, CONF_ARGS
 from esphome import automation
+import esphome.final_validate as fv
 from esphome.core import coroutine, Lambda
 from esphome.cpp_generator import MockObj
 
@@ -23,35 +24,86 @@ CONF_BLE_SERVICE = "service"
 CONF_BLE_CHARACTERISTICS = "characteristics"
 CONF_BLE_CHARACTERISTIC = "characteristic"
 CONF_BLE_USE_2902 = "use_BLE2902"
+CONF_BLE_NOTIFY_UNSUBSCRIBED = "notify_unsubscribed"
+CONF_BLE_LAZY_VALUE = "lazy_value"
 CONF_EXPOSES_COMPONENT = "exposes"
+CONF_BLE_NOTIFY_INTERVAL = "notify_interval"
+CONF_BLE_NOTIFY_DELTA = "notify_delta"
+CONF_BLE_ENCODING = "encoding"
+CONF_BLE_EXPONENT = "exponent"
+CONF_BLE_AGGREGATES = "aggregates"
+CONF_BLE_AGGREGATED_COMPONENTS = "components"
+CONF_BLE_FLUSH_INTERVAL = "flush_interval"
+
+BLEValueEncoding = esp32_ble_controller_ns.enum("BLEValueEncoding", is_class = True)
+BLE_VALUE_ENCODING_OPTIONS = {
+    'default': BLEValueEncoding.DEFAULT, # float for sensors, 2-byte integer for binary sensors and switches, string for fans and text sensors
+    'float': BLEValueEncoding.FLOAT32,
+    'sint16': BLEValueEncoding.SINT16, # scaled integers: value = raw value * 10^exponent
+    'uint16': BLEValueEncoding.UINT16,
+    'sint32': BLEValueEncoding.SINT32,
+    'uint32': BLEValueEncoding.UINT32,
+    'temperature': BLEValueEncoding.TEMPERATURE, # Bluetooth SIG types
+    'humidity': BLEValueEncoding.HUMIDITY,
+    'pressure': BLEValueEncoding.PRESSURE,
+    'packed': BLEValueEncoding.PACKED, # fans only
+}
+
+UUID_REGEX = r'^([0-9a-fA-F]{4}|[0-9a-fA-F]{8}|[0-9a-fA-F]{8}-?[0-9a-fA-F]{4}-?[0-9a-fA-F]{4}-?[0-9a-fA-F]{4}-?[0-9a-fA-F]{12})$'
 
 def validate_UUID(value):
-    # print("UUID«", value)
+    """Validates a 16 bit (4 hex digits), 32 bit (8 hex digits) or 128 bit UUID."""
     value = cv.string(value)
-    # TASK improve the regex
-    if re.match(r'^[0-9a-fA-F\-]{8,36}$', value) is None:
+    if re.match(UUID_REGEX, value) is None:
         raise cv.Invalid("valid UUID required")
     return value
 
+def parse_UUID(value):
+    """Parses a valid UUID into its bytes (most significant byte first)."""
+    return bytes.fromhex(value.replace('-', ''))
+
 BLE_CHARACTERISTIC = cv.Schema({
     cv.Required("characteristic"): validate_UUID,
     cv.GenerateID(CONF_EXPOSES_COMPONENT): cv.use_id(cg.EntityBase), # TASK validate that only supported EntityBase instances are referenced
     cv.Optional(CONF_BLE_USE_2902, default=True): cv.boolean,
+    cv.Optional(CONF_BLE_NOTIFY_UNSUBSCRIBED, default=True): cv.boolean,
+    cv.Optional(CONF_BLE_NOTIFY_INTERVAL, default='0ms'): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_BLE_NOTIFY_DELTA, default=0): cv.positive_float,
+    cv.Optional(CONF_BLE_ENCODING, default='default'): cv.enum(BLE_VALUE_ENCODING_OPTIONS),
+    cv.Optional(CONF_BLE_EXPONENT, default=0): cv.int_range(min=-10, max=10),
+    cv.Optional(CONF_BLE_LAZY_VALUE, default=False): cv.boolean,
+})
+
+BLE_AGGREGATE_MAX_COMPONENTS = 100 # see BLE_AGGREGATE_MAX_MEMBERS
+BLE_AGGREGATE_ENCODING_OPTIONS = {key: value for key, value in BLE_VALUE_ENCODING_OPTIONS.items() if key != 'packed'}
+
+BLE_AGGREGATE_CHARACTERISTIC = cv.Schema({
+    cv.Required(CONF_BLE_CHARACTERISTIC): validate_UUID,
+    cv.Required(CONF_BLE_AGGREGATED_COMPONENTS): cv.All(cv.ensure_list(cv.use_id(cg.EntityBase)), cv.Length(min=1, max=BLE_AGGREGATE_MAX_COMPONENTS)), # only sensors, binary sensors, and switches
+    cv.Optional(CONF_BLE_USE_2902, default=True): cv.boolean,
+    cv.Optional(CONF_BLE_NOTIFY_UNSUBSCRIBED, default=True): cv.boolean,
+    cv.Optional(CONF_BLE_FLUSH_INTERVAL, default='1s'): cv.positive_time_period_milliseconds,
+    cv.Optional(CONF_BLE_NOTIFY_DELTA, default=0): cv.positive_float,
+    cv.Optional(CONF_BLE_ENCODING, default='default'): cv.enum(BLE_AGGREGATE_ENCODING_OPTIONS),
+    cv.Optional(CONF_BLE_EXPONENT, default=0): cv.int_range(min=-10, max=10),
 })
 
 BLE_SERVICE = cv.Schema({
     cv.Required(CONF_BLE_SERVICE): validate_UUID,
-    cv.Required(CONF_BLE_CHARACTERISTICS): cv.ensure_list(BLE_CHARACTERISTIC),
+    cv.Optional(CONF_BLE_CHARACTERISTICS, default=[]): cv.ensure_list(BLE_CHARACTERISTIC),
+    cv.Optional(CONF_BLE_AGGREGATES, default=[]): cv.ensure_list(BLE_AGGREGATE_CHARACTERISTIC),
 })
 
 # custom commands #####
 CONF_BLE_COMMANDS = "commands"
 CONF_BLE_CMD_ID = "command"
+CONF_MAX_RUNNING_COMMANDS = "max_running_commands"
+CONF_COMMAND_TIMEOUT = "command_timeout"
 CONF_BLE_CMD_DESCRIPTION = "description"
 CONF_BLE_CMD_ON_EXECUTE = "on_execute"
 BLEControllerCustomCommandExecutionTrigger = esp32_ble_controller_ns.class_('BLEControllerCustomCommandExecutionTrigger', automation.Trigger.template())
 
-BUILTIN_CMD_IDS = ['help', 'ble-services', 'wifi-config', 'pairings', 'version', 'log-level']
+BUILTIN_CMD_IDS = ['help', 'ble-services', 'wifi-config', 'pairings', 'version', 'command-latency', 'connection-profile', 'connections', 'stats', 'log-level']
 CMD_ID_CHARACTERS = "abcdefghijklmnopqrstuvwxyz0123456789-"
 def validate_command_id(value):
     """Validate that this value is a valid command id.
@@ -74,6 +126,18 @@ BLE_COMMAND = cv.Schema({
 
 # BLE maintenance services #####
 CONF_EXPOSE_MAINTENANCE_SERVICE = "maintenance"
+CONF_MAINTENANCE_FRAMING = "maintenance_framing"
+CONF_MAINTENANCE_RPC = "maintenance_rpc"
+CONF_MAINTENANCE_DIAGNOSTICS = "maintenance_diagnostics"
+CONF_COMMAND_RESULT_DELIVERY = "command_result_delivery"
+BLECommandResultDelivery = esp32_ble_controller_ns.enum("BLECommandResultDelivery", is_class = True)
+COMMAND_RESULT_DELIVERY_OPTIONS = {
+    "read": BLECommandResultDelivery.READ,
+    "notify": BLECommandResultDelivery.NOTIFY,
+    "indicate": BLECommandResultDelivery.INDICATE,
+}
+CONF_LOG_BUFFER_SIZE = "log_buffer_size"
+CONF_BINARY_LOG_PREFIX = "binary_log_prefix"
 
 # security mode enumeration #####
 CONF_SECURITY_MODE = 'security_mode'
@@ -87,6 +151,79 @@ SECURTY_MODE_OPTIONS = {
     CONF_SECURITY_MODE_SECURE: BLESecurityMode.SECURE,
 }
 
+# connections #####
+CONF_MAX_CONNECTIONS = "max_connections"
+BLE_MAX_CONNECTIONS = 3 # see BLE_MAX_CONNECTIONS in ble_connection.h
+CONF_MTU = "mtu"
+CONF_DATA_LENGTH = "data_length"
+
+# connection profiles #####
+CONF_CONNECTION_PROFILE = "connection_profile"
+CONF_CONNECTION_PROFILES = "connection_profiles"
+CONF_MIN_INTERVAL = "min_interval"
+CONF_MAX_INTERVAL = "max_interval"
+CONF_LATENCY = "latency"
+CONF_SUPERVISION_TIMEOUT = "supervision_timeout"
+CONF_MIN_ADVERTISING_INTERVAL = "min_advertising_interval"
+CONF_MAX_ADVERTISING_INTERVAL = "max_advertising_interval"
+CONF_TX_POWER = "tx_power"
+BLEConnectionProfile = esp32_ble_controller_ns.enum("BLEConnectionProfile", is_class = True)
+CONNECTION_PROFILE_OPTIONS = {
+    'low-latency': BLEConnectionProfile.LOW_LATENCY,
+    'balanced': BLEConnectionProfile.BALANCED, # default
+    'low-power': BLEConnectionProfile.LOW_POWER,
+}
+# keep in sync with DEFAULT_CONNECTION_PARAMETERS in ble_connection.cpp (in milliseconds and dBm)
+CONNECTION_PROFILE_DEFAULTS = {
+    'low-latency': {CONF_MIN_INTERVAL: 7.5, CONF_MAX_INTERVAL: 15, CONF_LATENCY: 0, CONF_SUPERVISION_TIMEOUT: 2000, CONF_MIN_ADVERTISING_INTERVAL: 20, CONF_MAX_ADVERTISING_INTERVAL: 40, CONF_TX_POWER: 3},
+    'balanced': {CONF_MIN_INTERVAL: 30, CONF_MAX_INTERVAL: 50, CONF_LATENCY: 0, CONF_SUPERVISION_TIMEOUT: 4000, CONF_MIN_ADVERTISING_INTERVAL: 100, CONF_MAX_ADVERTISING_INTERVAL: 150, CONF_TX_POWER: 3},
+    'low-power': {CONF_MIN_INTERVAL: 100, CONF_MAX_INTERVAL: 200, CONF_LATENCY: 4, CONF_SUPERVISION_TIMEOUT: 6000, CONF_MIN_ADVERTISING_INTERVAL: 1000, CONF_MAX_ADVERTISING_INTERVAL: 1280, CONF_TX_POWER: -6},
+}
+TX_POWER_LEVELS = [-12, -9, -6, -3, 0, 3, 6, 9] # dBm, see esp_power_level_t
+
+def milliseconds(value):
+    """Validates a time period and returns it in (fractional) milliseconds, like 7.5 for the shortest connection interval."""
+    return cv.positive_time_period_microseconds(value).total_microseconds / 1000
+
+def validate_connection_profiles(config):
+    """Merges the overrides with the defaults of each profile and validates the resulting parameters against the Bluetooth specification."""
+    profiles = {}
+    for name, defaults in CONNECTION_PROFILE_DEFAULTS.items():
+        parameters = {**defaults, **config.get(name, {})}
+        if parameters[CONF_MIN_INTERVAL] > parameters[CONF_MAX_INTERVAL]:
+            raise cv.Invalid(f"{CONF_MIN_INTERVAL} of profile {name} must not be greater than {CONF_MAX_INTERVAL}")
+        if parameters[CONF_MIN_ADVERTISING_INTERVAL] > parameters[CONF_MAX_ADVERTISING_INTERVAL]:
+            raise cv.Invalid(f"{CONF_MIN_ADVERTISING_INTERVAL} of profile {name} must not be greater than {CONF_MAX_ADVERTISING_INTERVAL}")
+        # the connection must survive the events the peripheral may skip
+        if parameters[CONF_SUPERVISION_TIMEOUT] <= (1 + parameters[CONF_LATENCY]) * parameters[CONF_MAX_INTERVAL] * 2:
+            raise cv.Invalid(f"{CONF_SUPERVISION_TIMEOUT} of profile {name} must be greater than (1 + {CONF_LATENCY}) * {CONF_MAX_INTERVAL} * 2")
+        profiles[name] = parameters
+    return profiles
+
+CONNECTION_PARAMETERS = cv.Schema({
+    cv.Optional(CONF_MIN_INTERVAL): cv.All(milliseconds, cv.float_range(min=7.5, max=4000)),
+    cv.Optional(CONF_MAX_INTERVAL): cv.All(milliseconds, cv.float_range(min=7.5, max=4000)),
+    cv.Optional(CONF_LATENCY): cv.int_range(min=0, max=499),
+    cv.Optional(CONF_SUPERVISION_TIMEOUT): cv.All(milliseconds, cv.float_range(min=100, max=32000)),
+    cv.Optional(CONF_MIN_ADVERTISING_INTERVAL): cv.All(milliseconds, cv.float_range(min=20, max=10240)),
+    cv.Optional(CONF_MAX_ADVERTISING_INTERVAL): cv.All(milliseconds, cv.float_range(min=20, max=10240)),
+    cv.Optional(CONF_TX_POWER): cv.one_of(*TX_POWER_LEVELS, int=True),
+})
+
+# deferred functions queue #####
+CONF_DEFERRED_QUEUE_SIZE = "deferred_queue_size"
+CONF_DEFERRED_QUEUE_OVERFLOW = "deferred_queue_overflow"
+QueueOverflowPolicy = esp32_ble_controller_ns.enum("QueueOverflowPolicy", is_class = True)
+QUEUE_OVERFLOW_POLICY_OPTIONS = {
+    'drop_newest': QueueOverflowPolicy.DROP_NEWEST, # default: drops the function to be deferred
+    'drop_oldest': QueueOverflowPolicy.DROP_OLDEST, # drops the oldest deferred function
+    'coalesce': QueueOverflowPolicy.COALESCE, # skips functions (like handling a characteristic write) that are already queued, otherwise drops the newest
+}
+
+# loop budgets #####
+CONF_LOOP_TIME_BUDGET = "loop_time_budget"
+CONF_LOOP_ITEM_BUDGET = "loop_item_budget"
+
 # authetication and (dis)connected automations #####
 CONF_ON_SHOW_PASS_KEY = "on_show_pass_key"
 BLEControllerShowPassKeyTrigger = esp32_ble_controller_ns.class_('BLEControllerShowPassKeyTrigger', automation.Trigger.template())
@@ -128,11 +265,31 @@ CONFIG_SCHEMA = cv.All(cv.only_on_esp32, cv.only_with_arduino, cv.Schema({
     cv.Optional(CONF_BLE_SERVICES): cv.ensure_list(BLE_SERVICE),
 
     cv.Optional(CONF_BLE_COMMANDS): cv.ensure_list(BLE_COMMAND),
+    cv.Optional(CONF_MAX_RUNNING_COMMANDS, default=4): cv.int_range(min=1, max=16),
+    cv.Optional(CONF_COMMAND_TIMEOUT, default='5min'): cv.positive_time_period_milliseconds,
 
     cv.Optional(CONF_EXPOSE_MAINTENANCE_SERVICE, default=True): cv.boolean,
+    cv.Optional(CONF_MAINTENANCE_FRAMING, default=False): cv.boolean,
+    cv.Optional(CONF_MAINTENANCE_RPC, default=False): cv.boolean,
+    cv.Optional(CONF_MAINTENANCE_DIAGNOSTICS, default=False): cv.boolean,
+    cv.Optional(CONF_COMMAND_RESULT_DELIVERY, default="notify"): cv.enum(COMMAND_RESULT_DELIVERY_OPTIONS),
+    cv.Optional(CONF_LOG_BUFFER_SIZE, default=1024): cv.int_range(min=128, max=16384),
+    cv.Optional(CONF_BINARY_LOG_PREFIX, default=False): cv.boolean,
 
     cv.Optional(CONF_SECURITY_MODE, default=CONF_SECURITY_MODE_SECURE): cv.enum(SECURTY_MODE_OPTIONS),
 
+    cv.Optional(CONF_MAX_CONNECTIONS, default=1): cv.int_range(min=1, max=BLE_MAX_CONNECTIONS),
+    cv.Optional(CONF_MTU, default=247): cv.int_range(min=23, max=517),
+    cv.Optional(CONF_DATA_LENGTH, default=251): cv.int_range(min=27, max=251),
+    cv.Optional(CONF_CONNECTION_PROFILE, default='balanced'): cv.enum(CONNECTION_PROFILE_OPTIONS),
+    cv.Optional(CONF_CONNECTION_PROFILES, default={}): cv.All(cv.Schema({cv.Optional(name): CONNECTION_PARAMETERS for name in CONNECTION_PROFILE_OPTIONS}), validate_connection_profiles),
+
+    cv.Optional(CONF_DEFERRED_QUEUE_SIZE, default=16): cv.int_range(min=1, max=1024),
+    cv.Optional(CONF_DEFERRED_QUEUE_OVERFLOW, default='drop_newest'): cv.enum(QUEUE_OVERFLOW_POLICY_OPTIONS),
+
+    cv.Optional(CONF_LOOP_TIME_BUDGET, default='0ms'): cv.positive_time_period_microseconds,
+    cv.Optional(CONF_LOOP_ITEM_BUDGET, default=0): cv.positive_int,
+
     cv.Optional(CONF_ON_SHOW_PASS_KEY): automation.validate_automation({
         cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(BLEControllerShowPassKeyTrigger),
     }),
@@ -149,25 +306,98 @@ CONFIG_SCHEMA = cv.All(cv.only_on_esp32, cv.only_with_arduino, cv.Schema({
 
     }), automations_available, required_automations_present)
 
+# the value of these components is a string unless encoded as packed binary
+STRING_VALUED_DOMAINS = {'fan': ['default', 'packed'], 'text_sensor': ['default']}
+
+def validate_encodings_for_components(config):
+    """Validates that the encoding of each characteristic fits the kind of the exposed component (only known once all components are configured)."""
+    full_config = fv.full_config.get()
+    for service in config.get(CONF_BLE_SERVICES, []):
+        for characteristic_description in service[CONF_BLE_CHARACTERISTICS]:
+            component_id = characteristic_description[CONF_EXPOSES_COMPONENT]
+            domain = full_config.get_path_for_id(component_id)[0]
+            encoding = characteristic_description[CONF_BLE_ENCODING]
+            allowed_encodings = STRING_VALUED_DOMAINS.get(domain)
+            if allowed_encodings is not None and encoding not in allowed_encodings:
+                raise cv.Invalid(f"Encoding '{encoding}' is not supported for {domain} {component_id}, use one of {', '.join(allowed_encodings)}")
+            if allowed_encodings is None and encoding == 'packed':
+                raise cv.Invalid(f"Encoding 'packed' is only supported for fans, not for {domain} {component_id}")
+    return config
+
+FINAL_VALIDATE_SCHEMA = validate_encodings_for_components
+
 ### Code generation ############################################################################################
 
+# name of the generated constant table that describes all characteristics exposing components
+CHARACTERISTICS_TABLE = "esp32_ble_controller_characteristics"
+# name of the generated constant table that describes all services with characteristics exposing components
+SERVICES_TABLE = "esp32_ble_controller_services"
+
+def uuid_to_cpp(uuid):
+    """Generates the initializer for a BLEUUIDBytes structure."""
+    uuid_bytes = parse_UUID(uuid)
+    return "{%d, {%s}}" % (len(uuid_bytes), ", ".join("0x%02x" % b for b in uuid_bytes))
+
+def characteristic_info_to_cpp(service_uuid, characteristic_description, is_aggregate = False):
+    """Generates the initializer for a BLECharacteristicInfoForHandler structure."""
+    notify_interval = characteristic_description[CONF_BLE_FLUSH_INTERVAL if is_aggregate else CONF_BLE_NOTIFY_INTERVAL]
+    fields = [
+        uuid_to_cpp(service_uuid),
+        uuid_to_cpp(characteristic_description[CONF_BLE_CHARACTERISTIC]),
+        "true" if characteristic_description[CONF_BLE_USE_2902] else "false",
+        "true" if characteristic_description[CONF_BLE_NOTIFY_UNSUBSCRIBED] else "false",
+        "%d" % notify_interval.total_milliseconds,
+        "%rf" % float(characteristic_description[CONF_BLE_NOTIFY_DELTA]),
+        str(characteristic_description[CONF_BLE_ENCODING].enum_value),
+        "%d" % characteristic_description[CONF_BLE_EXPONENT],
+        "true" if characteristic_description.get(CONF_BLE_LAZY_VALUE, False) else "false", # aggregates build their frames lazily anyway
+        "true" if is_aggregate else "false",
+    ]
+    return "{" + ", ".join(fields) + "}"
+
+def characteristic_handle_count(characteristic_description, is_aggregate = False):
+    """Counts the attribute handles of a characteristic: declaration, value, user description (0x2901), and the optional 0x2902 and 0x2904 descriptors."""
+    count = 3
+    if characteristic_description[CONF_BLE_USE_2902]:
+        count += 1
+    if is_aggregate or characteristic_description[CONF_BLE_ENCODING] != 'default':
+        count += 1
+    return count
+
+def characteristics_handle_count(service):
+    """Counts the attribute handles of all characteristics and aggregates of a service (without the service declaration)."""
+    return (sum(characteristic_handle_count(characteristic_description) for characteristic_description in service[CONF_BLE_CHARACTERISTICS])
+        + sum(characteristic_handle_count(aggregate_description, True) for aggregate_description in service[CONF_BLE_AGGREGATES]))
+
 @coroutine
-def to_code_characteristic(ble_controller_var, service_uuid, characteristic_description):
+def to_code_characteristic(ble_controller_var, service_uuid, characteristic_description, characteristic_infos):
     """Coroutine that registers the given characteristic of the given service with BLE controller, 
-    i.e. generates a single controller->register_component(...) call"""
-    characteristic_uuid = characteristic_description[CONF_BLE_CHARACTERISTIC]
+    i.e. adds an entry to the characteristics table and generates a single controller->register_component(...) call"""
     component_id = characteristic_description[CONF_EXPOSES_COMPONENT]
     component = yield cg.get_variable(component_id)
-    use_BLE2902 = characteristic_description[CONF_BLE_USE_2902]
-    cg.add(ble_controller_var.register_component(component, service_uuid, characteristic_uuid, use_BLE2902))
+    characteristic_info = cg.RawExpression("%s[%d]" % (CHARACTERISTICS_TABLE, len(characteristic_infos)))
+    characteristic_infos.append(characteristic_info_to_cpp(service_uuid, characteristic_description))
+    cg.add(ble_controller_var.register_component(component, characteristic_info))
+
+@coroutine
+def to_code_aggregate(ble_controller_var, service_uuid, aggregate_description, characteristic_infos):
+    """Coroutine that registers the given aggregate characteristic of the given service with BLE controller,
+    i.e. adds a single entry to the characteristics table and registers all aggregated components with this entry"""
+    characteristic_info = cg.RawExpression("%s[%d]" % (CHARACTERISTICS_TABLE, len(characteristic_infos)))
+    characteristic_infos.append(characteristic_info_to_cpp(service_uuid, aggregate_description, True))
+    for component_id in aggregate_description[CONF_BLE_AGGREGATED_COMPONENTS]:
+        component = yield cg.get_variable(component_id)
+        cg.add(ble_controller_var.register_component(component, characteristic_info))
     
 @coroutine
-def to_code_service(ble_controller_var, service):
+def to_code_service(ble_controller_var, service, characteristic_infos):
     """Coroutine that registers all characteristics of the given service with BLE controller"""
     service_uuid = service[CONF_BLE_SERVICE]
     characteristics = service[CONF_BLE_CHARACTERISTICS]
     for characteristic_description in characteristics:
-        yield to_code_characteristic(ble_controller_var, service_uuid, characteristic_description)
+        yield to_code_characteristic(ble_controller_var, service_uuid, characteristic_description, characteristic_infos)
+    for aggregate_description in service[CONF_BLE_AGGREGATES]:
+        yield to_code_aggregate(ble_controller_var, service_uuid, aggregate_description, characteristic_infos)
 
 @coroutine
 def to_code_command(ble_controller_var, cmd):
@@ -176,7 +406,8 @@ def to_code_command(ble_controller_var, cmd):
     description = cmd[CONF_BLE_CMD_DESCRIPTION]
     trigger_conf = cmd[CONF_BLE_CMD_ON_EXECUTE][0]
     trigger = cg.new_Pvariable(trigger_conf[CONF_TRIGGER_ID], ble_controller_var)
-    yield automation.build_automation(trigger, [(cg.std_ns.class_("vector<std::string>"), 'arguments'), (esp32_ble_controller_ns.class_("BLECustomCommandResultSender"), 'result')], trigger_conf)
+    automation_var = yield automation.build_automation(trigger, [(cg.std_ns.class_("vector<std::string>"), 'arguments'), (esp32_ble_controller_ns.class_("BLECustomCommandResultSender"), 'result')], trigger_conf)
+    cg.add(trigger.track_completion(automation_var))
     cg.add(ble_controller_var.register_command(id, description, trigger))
 
 def to_code(config):
@@ -184,17 +415,56 @@ def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     yield cg.register_component(var, config)
 
-    for cmd in config.get(CONF_BLE_SERVICES, []):
-        yield to_code_service(var, cmd)
+    characteristic_infos = []
+    # UUID and handle count by service (a service may be listed several times, but has only one declaration)
+    service_handles = {}
+    for service in config.get(CONF_BLE_SERVICES, []):
+        yield to_code_service(var, service, characteristic_infos)
+        uuid, handles = service_handles.get(parse_UUID(service[CONF_BLE_SERVICE]), (service[CONF_BLE_SERVICE], 1))
+        service_handles[parse_UUID(uuid)] = (uuid, handles + characteristics_handle_count(service))
+    if characteristic_infos:
+        cg.add_global(cg.RawStatement("static constexpr esphome::esp32_ble_controller::BLECharacteristicInfoForHandler %s[] = {\n  %s\n};"
+            % (CHARACTERISTICS_TABLE, ",\n  ".join(characteristic_infos))))
+    if service_handles:
+        service_infos = ["{%s, %d}" % (uuid_to_cpp(uuid), handles) for uuid, handles in service_handles.values()]
+        cg.add_global(cg.RawStatement("static constexpr esphome::esp32_ble_controller::BLEServiceInfo %s[] = {\n  %s\n};"
+            % (SERVICES_TABLE, ",\n  ".join(service_infos))))
+        for index in range(len(service_infos)):
+            cg.add(var.register_service(cg.RawExpression("%s[%d]" % (SERVICES_TABLE, index))))
 
     for cmd in config.get(CONF_BLE_COMMANDS, []):
         yield to_code_command(var, cmd)
+    cg.add(var.set_max_running_commands(config[CONF_MAX_RUNNING_COMMANDS]))
+    cg.add(var.set_command_timeout(config[CONF_COMMAND_TIMEOUT]))
 
     cg.add(var.set_maintenance_service_exposed_after_flash(config[CONF_EXPOSE_MAINTENANCE_SERVICE]))
+    cg.add(var.set_maintenance_framing(config[CONF_MAINTENANCE_FRAMING]))
+    cg.add(var.set_maintenance_rpc(config[CONF_MAINTENANCE_RPC]))
+    cg.add(var.set_maintenance_diagnostics(config[CONF_MAINTENANCE_DIAGNOSTICS]))
+    cg.add(var.set_command_result_delivery(config[CONF_COMMAND_RESULT_DELIVERY]))
+    cg.add(var.set_log_buffer_size(config[CONF_LOG_BUFFER_SIZE]))
+    cg.add(var.set_binary_log_prefix(config[CONF_BINARY_LOG_PREFIX]))
 
     security_enabled = SECURTY_MODE_OPTIONS[config[CONF_SECURITY_MODE]]
     cg.add(var.set_security_mode(config[CONF_SECURITY_MODE]))
 
+    cg.add(var.set_max_connections(config[CONF_MAX_CONNECTIONS]))
+    cg.add(var.set_preferred_mtu(config[CONF_MTU]))
+    cg.add(var.set_preferred_data_length(config[CONF_DATA_LENGTH]))
+    cg.add(var.set_connection_profile(config[CONF_CONNECTION_PROFILE]))
+    for name, parameters in config[CONF_CONNECTION_PROFILES].items():
+        # in the units of the Bluetooth specification: connection intervals in 1.25ms, timeout in 10ms, advertising intervals in 0.625ms
+        cg.add(var.set_connection_parameters(CONNECTION_PROFILE_OPTIONS[name],
+            round(parameters[CONF_MIN_INTERVAL] / 1.25), round(parameters[CONF_MAX_INTERVAL] / 1.25), parameters[CONF_LATENCY],
+            round(parameters[CONF_SUPERVISION_TIMEOUT] / 10), round(parameters[CONF_MIN_ADVERTISING_INTERVAL] / 0.625),
+            round(parameters[CONF_MAX_ADVERTISING_INTERVAL] / 0.625), parameters[CONF_TX_POWER]))
+
+    cg.add(var.set_deferred_queue_size(config[CONF_DEFERRED_QUEUE_SIZE]))
+    cg.add(var.set_deferred_queue_overflow_policy(config[CONF_DEFERRED_QUEUE_OVERFLOW]))
+
+    cg.add(var.set_loop_time_budget(config[CONF_LOOP_TIME_BUDGET]))
+    cg.add(var.set_loop_item_budget(config[CONF_LOOP_ITEM_BUDGET]))
+
     for conf in config.get(CONF_ON_SHOW_PASS_KEY, []):
         trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
         yield automation.build_automation(trigger, [(cg.std_string, 'pass_key')], conf)
@@ -263,7 +533,11 @@ BLE_CMD_SET_RESULT_ACTION_SCHEMA = cv.All(
 async def ble_cmd_set_result_action_to_code(config, action_id, template_arg, args):
     args_ = [cg.RawExpression(str(x)) for x in config[CONF_ARGS]]
 
-    text = str(cg.statement(GLOBAL_BLE_CONTROLLER_VAR.send_command_result(config[CONF_FORMAT], *args_)))
+    if any(name == 'result' for _, name in args):
+        # within a custom command: tag the result with the invocation
+        text = str(cg.statement(GLOBAL_BLE_CONTROLLER_VAR.send_command_result(cg.RawExpression("result.get_invocation_id()"), config[CONF_FORMAT], *args_)))
+    else:
+        text = str(cg.statement(GLOBAL_BLE_CONTROLLER_VAR.send_command_result(config[CONF_FORMAT], *args_)))
 
     lambda_ = await cg.process_lambda(Lambda(text), args, return_type=cg.void)
     return cg.new_Pvariable(action_id, template_arg, lambda_)
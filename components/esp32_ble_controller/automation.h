@@ -58,15 +58,36 @@ public:
 
 // custom command execution ///////////////////////////////////////////////////////////////////////////////////////////////
 
+/// Sends results of a single invocation of a custom command, tagged with the id of the invocation. It is passed by value through the automation, so it stays valid across delays.
 class BLECustomCommandResultSender {
 public:
-  void operator=(const string& result) { global_ble_controller->send_command_result(result); }
+  BLECustomCommandResultSender(uint16_t invocation_id = 0) : invocation_id(invocation_id) {}
+
+  void operator=(const string& result) { global_ble_controller->send_command_result(invocation_id, result); }
+
+  uint16_t get_invocation_id() const { return invocation_id; }
+
+private:
+  uint16_t invocation_id;
+};
+
+/// Action appended to the automation of a custom command, which marks the invocation as completed.
+class BLECustomCommandCompletionAction : public Action<std::vector<std::string>, BLECustomCommandResultSender> {
+public:
+  void play(std::vector<std::string> arguments, BLECustomCommandResultSender result) override {
+    global_ble_controller->complete_command_invocation(result.get_invocation_id());
+  }
 };
 
 /// Trigger that is fired when a custom command is executed.
 class BLEControllerCustomCommandExecutionTrigger : public Trigger<std::vector<std::string>, BLECustomCommandResultSender> {
 public:
   BLEControllerCustomCommandExecutionTrigger(ESP32BLEController* controller) {}
+
+  /// Appends the completion action to the given automation of this trigger, so that running invocations can be tracked.
+  void track_completion(Automation<std::vector<std::string>, BLECustomCommandResultSender>* automation) {
+    automation->add_action(new BLECustomCommandCompletionAction());
+  }
 };
 
 // actions for BLE maintenance service ////////////////////////////////////////////////////////////////////////////////////
@@ -84,7 +105,8 @@ public:
 template<typename... Ts> class ToggleMaintenanceServiceAction : public Action<Ts...> {
 public:
   void play(Ts... x) override {
-    const bool exposed = global_ble_controller->get_maintenance_service_exposed();
+    // the requested mode, so that toggling twice in a row (before the switch is applied) switches back
+    const bool exposed = global_ble_controller->get_requested_maintenance_service_exposed();
     global_ble_controller->switch_maintenance_service_exposed(!exposed); 
   }
 };
@@ -0,0 +1,140 @@
+#include "ble_aggregate_handler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "esphome/core/log.h"
+
+#include "esp32_ble_controller.h"
+#include "ble_utils.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static const char *TAG = "ble_aggregate_handler";
+
+BLEAggregateHandler::BLEAggregateHandler(const BLECharacteristicInfoForHandler& characteristic_info)
+  : BLEComponentHandlerBase(nullptr, characteristic_info)
+{
+  // the members are changed in the loop, so the frame is built there as well
+  set_state_encoder([this]() { store_full_frame(); }, false);
+}
+
+bool BLEAggregateHandler::add_member(EntityBase* component, size_t& index) {
+  if (members.size() >= BLE_AGGREGATE_MAX_MEMBERS) {
+    ESP_LOGW(TAG, "Aggregate full, component %s cannot be added", component->get_object_id().c_str());
+    return false;
+  }
+
+  index = members.size();
+  members.push_back({component, NAN, NAN, false});
+  frame.resize(get_bitmap_size() + members.size() * get_value_size());
+  return true;
+}
+
+string BLEAggregateHandler::get_object_id() {
+  return "aggregate " + to_ble_uuid(get_characteristic_info().characteristic_UUID).toString();
+}
+
+string BLEAggregateHandler::get_component_description() {
+  return "Aggregate of " + std::to_string(members.size()) + " components";
+}
+
+void BLEAggregateHandler::setup_presentation_format() {
+  add_presentation_format_descriptor(get_characteristic(), get_presentation_format(BLEValueEncoding::PACKED, 0));
+}
+
+void BLEAggregateHandler::store_full_frame() {
+  const size_t frame_size = build_frame(false, frame.size());
+  get_characteristic()->setValue(frame.data(), frame_size);
+}
+
+size_t BLEAggregateHandler::get_value_size() const {
+  uint8_t encoded_value[BLE_MAX_ENCODED_FLOAT_SIZE];
+  const BLECharacteristicInfoForHandler& info = get_characteristic_info();
+  return encode_float_value(0, info.encoding, info.exponent, encoded_value);
+}
+
+void BLEAggregateHandler::send_value(size_t index, float value) {
+  Member& member = members[index];
+  ESP_LOGV(TAG, "Update component %s to %f", member.component->get_object_id().c_str(), value);
+
+  member.value = value;
+  // the frame returned on read contains the new value in any case, the deadband only gates the notification
+  mark_value_outdated();
+
+  const float delta = get_characteristic_info().notify_delta;
+  if (delta > 0 && !std::isnan(value) && !std::isnan(member.last_sent_value) && std::fabs(value - member.last_sent_value) < delta) {
+    count_suppressed_value();
+    return;
+  }
+
+  if (!member.changed) {
+    member.changed = true;
+    ++changed_count;
+  }
+  // flushed from the loop, so that all changes of a loop iteration end up in the same frame
+  schedule_notification();
+}
+
+bool BLEAggregateHandler::send_notification() {
+  BLECharacteristic* characteristic = get_characteristic();
+
+  bool sent = false;
+  if (has_listeners()) {
+    const size_t max_frame_size = std::min(global_ble_controller->get_max_notification_size(), frame.size());
+    while (changed_count > 0) {
+      const size_t frame_size = build_frame(true, max_frame_size);
+      characteristic->setValue(frame.data(), frame_size);
+      sent |= notify_listeners();
+    }
+  } else {
+    // nobody listens, the changes are only part of the frame returned on read
+    for (auto& member : members) {
+      if (member.changed) {
+        count_suppressed_value();
+      }
+      member.changed = false;
+    }
+    changed_count = 0;
+  }
+
+  // reads return all values
+  refresh_value();
+  return sent;
+}
+
+size_t BLEAggregateHandler::build_frame(bool changed_only, size_t max_size) {
+  const size_t bitmap_size = get_bitmap_size();
+  const size_t value_size = get_value_size();
+  const BLECharacteristicInfoForHandler& info = get_characteristic_info();
+
+  uint8_t* bitmap = frame.data();
+  memset(bitmap, 0, bitmap_size);
+
+  size_t frame_size = bitmap_size;
+  for (size_t i = 0; i < members.size(); i++) {
+    Member& member = members[i];
+    if (changed_only && !member.changed) {
+      continue;
+    }
+    if (frame_size + value_size > max_size) {
+      break; // remaining values go into the next frame
+    }
+
+    frame_size += encode_float_value(member.value, info.encoding, info.exponent, frame.data() + frame_size);
+    bitmap[i / 8] |= 1 << (i % 8);
+
+    if (changed_only) {
+      member.changed = false;
+      member.last_sent_value = member.value;
+      --changed_count;
+    }
+  }
+
+  return frame_size;
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
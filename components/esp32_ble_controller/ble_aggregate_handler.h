@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ble_component_handler_base.h"
+
+using std::string;
+using std::vector;
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/// Maximum number of components in an aggregate, so that the change bitmap plus one value always fit into a notification with the default MTU.
+static const size_t BLE_AGGREGATE_MAX_MEMBERS = 100;
+
+/**
+ * Handler for a characteristic that aggregates the latest values of several components (sensors, binary sensors, switches) into one binary frame.
+ * Value changes are collected and flushed from the loop at most once per notify (flush) interval, so a node with many sensors needs a single notification per update cycle.
+ * <para>
+ * A frame consists of a change bitmap (one bit per component in configuration order, least significant bit first) followed by the encoded values of all components whose bit is set.
+ * Notifications only contain the changed values and are split into several frames if they do not fit into the negotiated MTU.
+ * Reading the characteristic returns a frame with the values of all components.
+ * @brief Exposes the values of several components by a single characteristic.
+ */
+class BLEAggregateHandler : public BLEComponentHandlerBase {
+public:
+  BLEAggregateHandler(const BLECharacteristicInfoForHandler& characteristic_info);
+  virtual ~BLEAggregateHandler() {}
+
+  /**
+   * Adds a component to the aggregate (only before setup).
+   * @param index the index of the component in the frame
+   * @return false if the aggregate is full
+   */
+  bool add_member(EntityBase* component, size_t& index);
+
+  void send_value(size_t index, float value);
+  void send_value(size_t index, bool value) { send_value(index, value ? 1.0f : 0.0f); }
+
+protected:
+  virtual string get_object_id() override;
+  virtual string get_component_description() override;
+  virtual void setup_presentation_format() override;
+  virtual bool send_notification() override;
+
+private:
+  struct Member {
+    EntityBase* component;
+    float value;
+    float last_sent_value;
+    bool changed;
+  };
+
+  size_t get_bitmap_size() const { return (members.size() + 7) / 8; }
+  size_t get_value_size() const;
+
+  /**
+   * Encodes the values into the frame buffer.
+   * @param changed_only if true only changed values are included (and marked as sent), otherwise all values
+   * @param max_size maximum number of bytes of the frame, remaining changed values stay marked as changed
+   * @return the size of the frame
+   */
+  size_t build_frame(bool changed_only, size_t max_size);
+  /// Stores the frame with all values, which is returned on read.
+  void store_full_frame();
+
+  vector<Member> members;
+  size_t changed_count{0};
+  vector<uint8_t> frame;
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
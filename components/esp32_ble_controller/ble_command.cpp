@@ -25,7 +25,7 @@ string BLECommand::get_command_specific_help() const {
 
 BLECommandHelp::BLECommandHelp() : BLECommand("help", "shows help for commands.") {}
 
-void BLECommandHelp::execute(const vector<string>& arguments) const {
+void BLECommandHelp::execute(const BLECommandArguments& arguments) const {
   if (arguments.empty()) {
     string help("Availabe:");
     for (const auto& command : global_ble_controller->get_commands()) {
@@ -35,13 +35,11 @@ void BLECommandHelp::execute(const vector<string>& arguments) const {
     help += ", 'help <cmd>' for more.";
     set_result(help);
   } else {
-    string command_name = arguments[0];
-    for (const auto& command : global_ble_controller->get_commands()) {
-      if (command->get_name() == command_name) {
-        set_result(command_name + ": " + command->get_command_specific_help());
-        return;
-      }
-      set_result("Unknown BLE command '" + command_name + "'");
+    const BLECommand* command = global_ble_controller->find_command(arguments[0]);
+    if (command != nullptr) {
+      set_result(command->get_name() + ": " + command->get_command_specific_help());
+    } else {
+      set_result("Unknown BLE command '" + arguments[0].str() + "'");
     }
   }
 }
@@ -50,25 +48,28 @@ void BLECommandHelp::execute(const vector<string>& arguments) const {
 
 BLECommandSwitchMaintenanceOnOrOff::BLECommandSwitchMaintenanceOnOrOff() : BLECommand("ble-maintenance", "'ble-maintenance off' disables the maintenance BLE service.") {}
 
-void BLECommandSwitchMaintenanceOnOrOff::execute(const vector<string>& arguments) const {
+void BLECommandSwitchMaintenanceOnOrOff::execute(const BLECommandArguments& arguments) const {
   if (!arguments.empty()) {
-    const string& on_or_off = arguments[0];
+    const BLEStringRef& on_or_off = arguments[0];
     global_ble_controller->switch_maintenance_service_exposed(on_or_off != "off");
   }
-  string enabled_or_disabled = global_ble_controller->get_component_services_exposed() ? "disabled" : "enabled";
-  set_result("Maintenance services is " + enabled_or_disabled +".");
+  // the requested mode, the service is added or removed shortly after the result has been sent
+  const bool exposed = global_ble_controller->get_requested_maintenance_service_exposed();
+  string enabled_or_disabled = exposed ? "enabled" : "disabled";
+  set_result("Maintenance service is " + enabled_or_disabled +".");
 }
 
 // ble-services ///////////////////////////////////////////////////////////////////////////////////////////////
 
 BLECommandSwitchComponentServicesOnOrOff::BLECommandSwitchComponentServicesOnOrOff() : BLECommand("ble-services", "'ble-services on|off' enables or disables the non-maintenance BLE services.") {}
 
-void BLECommandSwitchComponentServicesOnOrOff::execute(const vector<string>& arguments) const {
+void BLECommandSwitchComponentServicesOnOrOff::execute(const BLECommandArguments& arguments) const {
   if (!arguments.empty()) {
-    const string& on_or_off = arguments[0];
+    const BLEStringRef& on_or_off = arguments[0];
     global_ble_controller->switch_component_services_exposed(on_or_off != "off");
   }
-  string enabled_or_disabled = global_ble_controller->get_component_services_exposed() ? "disabled" : "enabled";
+  const bool exposed = global_ble_controller->get_requested_component_services_exposed();
+  string enabled_or_disabled = exposed ? "enabled" : "disabled";
   set_result("Non-maintenance services are " + enabled_or_disabled +".");
 }
 
@@ -77,10 +78,10 @@ void BLECommandSwitchComponentServicesOnOrOff::execute(const vector<string>& arg
 #ifdef USE_WIFI
 BLECommandWifiConfiguration::BLECommandWifiConfiguration() : BLECommand("wifi-config", "sets or clears the WIFI configuration") {}
 
-void BLECommandWifiConfiguration::execute(const vector<string>& arguments) const {
+void BLECommandWifiConfiguration::execute(const BLECommandArguments& arguments) const {
   if (arguments.size() >= 2 && arguments.size() <= 3) {
-    const string& ssid = arguments[0];
-    const string& password = arguments[1];
+    const string ssid = arguments[0].str();
+    const string password = arguments[1].str();
     const bool hidden_network = arguments.size() == 3 && arguments[2] == "hidden";
     global_ble_controller->set_wifi_configuration(ssid, password, hidden_network);
     set_result("WIFI configuration updated.");
@@ -113,7 +114,7 @@ string BLECommandWifiConfiguration::get_command_specific_help() const {
 
 BLECommandPairings::BLECommandPairings() : BLECommand("pairings", "'pairings [clear]' displays or clears the paired devices.") {}
 
-void BLECommandPairings::execute(const vector<string>& arguments) const {
+void BLECommandPairings::execute(const BLECommandArguments& arguments) const {
   if (!arguments.empty()) {
     if (arguments[0] == "clear") {
       remove_all_bonded_devices();
@@ -139,19 +140,104 @@ void BLECommandPairings::execute(const vector<string>& arguments) const {
 
 BLECommandVersion::BLECommandVersion() : BLECommand("version", "displays the current version, i.e. compile time.") {}
 
-void BLECommandVersion::execute(const vector<string>& arguments) const {
+void BLECommandVersion::execute(const BLECommandArguments& arguments) const {
   set_result("Version: " + App.get_compilation_time());
 }
 
+// command-latency ///////////////////////////////////////////////////////////////////////////////////////////////
+
+BLECommandLatency::BLECommandLatency() : BLECommand("command-latency", "displays the time between receiving a command and sending its result.") {}
+
+void BLECommandLatency::execute(const BLECommandArguments& arguments) const {
+  const BLECommandLatencyStatistics& statistics = global_ble_controller->get_command_latency_statistics();
+  // the result of this command is not yet included
+  global_ble_controller->send_command_result("Command latency: last %u us, average %u us, max %u us (%u commands).",
+    statistics.last_us, statistics.get_average_us(), statistics.max_us, statistics.count);
+}
+
+// connection-profile ///////////////////////////////////////////////////////////////////////////////////////////////
+
+BLECommandConnectionProfile::BLECommandConnectionProfile() : BLECommand("connection-profile", "gets or sets the connection profile (low-latency, balanced, low-power), applied to the next connection.") {}
+
+void BLECommandConnectionProfile::execute(const BLECommandArguments& arguments) const {
+  if (!arguments.empty()) {
+    bool found = false;
+    for (size_t i = 0; i < BLE_CONNECTION_PROFILE_COUNT; ++i) {
+      const BLEConnectionProfile profile = static_cast<BLEConnectionProfile>(i);
+      if (arguments[0] == get_connection_profile_name(profile)) {
+        global_ble_controller->set_connection_profile(profile);
+        found = true;
+      }
+    }
+    if (!found) {
+      set_result("Unknown connection profile '" + arguments[0].str() + "'.");
+      return;
+    }
+  }
+
+  const BLEConnectionProfile profile = global_ble_controller->get_connection_profile();
+  const BLEConnectionParameters& parameters = global_ble_controller->get_connection_parameters(profile);
+  global_ble_controller->send_command_result("Connection profile is %s: interval %u-%u us, latency %u, timeout %u ms, TX power %d dBm.",
+    get_connection_profile_name(profile), parameters.min_interval * 1250, parameters.max_interval * 1250, parameters.latency, parameters.timeout * 10, parameters.tx_power);
+}
+
+// connections ///////////////////////////////////////////////////////////////////////////////////////////////
+
+BLECommandConnections::BLECommandConnections() : BLECommand("connections", "lists the connected clients with their MTU and data length.") {}
+
+void BLECommandConnections::execute(const BLECommandArguments& arguments) const {
+  const vector<BLEConnectionContext> connections = global_ble_controller->get_connections();
+  string result = to_string(connections.size()) + " connected:";
+  for (const auto& connection : connections) {
+    result += " #" + to_string(connection.conn_id) + " " + bd_address_to_string(connection.address)
+      + " MTU " + to_string(connection.mtu) + " DL " + to_string(connection.data_length) + (connection.authenticated ? " secure" : "") + ";";
+  }
+  set_result(result);
+}
+
+// stats ///////////////////////////////////////////////////////////////////////////////////////////////
+
+BLECommandStatistics::BLECommandStatistics() : BLECommand("stats", "shows runtime statistics, 'stats reset' resets them.") {}
+
+void BLECommandStatistics::execute(const BLECommandArguments& arguments) const {
+  if (!arguments.empty() && arguments[0] == "reset") {
+    global_ble_controller->reset_statistics();
+    set_result("Statistics reset.");
+    return;
+  }
+
+  const BLETrafficStatistics& traffic = global_ble_controller->get_traffic_statistics();
+  const BLEHandlerStatistics total = global_ble_controller->get_handler_statistics_total();
+  const auto& queue = global_ble_controller->get_deferred_functions_queue();
+
+  string result = "Notified " + to_string(traffic.notifications) + " (" + to_string(traffic.bytes_sent) + " B), written " + to_string(total.writes_received)
+    + ", suppressed " + to_string(total.values_suppressed) + ".\nQueue " + to_string(queue.size()) + "/" + to_string(queue.get_capacity())
+    + ", max " + to_string(queue.get_high_water_mark()) + ", dropped " + to_string(queue.get_dropped_count()) + ".\nLatency:";
+  for (size_t i = 0; i < BLELatencyHistogram::BUCKET_COUNT; ++i) {
+    const uint32_t bound_ms = BLELatencyHistogram::get_upper_bound_ms(i);
+    result += bound_ms != 0 ? " <" + to_string(bound_ms) + "ms " : " more ";
+    result += to_string(total.notify_latency.buckets[i]);
+  }
+  for (auto* handler : global_ble_controller->get_handlers()) {
+    const BLEHandlerStatistics& statistics = handler->get_statistics();
+    result += "\n" + handler->get_object_id() + ": notified " + to_string(statistics.traffic.notifications)
+      + ", written " + to_string(statistics.writes_received) + ", suppressed " + to_string(statistics.values_suppressed);
+  }
+  set_result(result);
+}
+
+string BLECommandStatistics::get_command_specific_help() const {
+  return get_description() + " Notifications and bytes include all characteristics, latency is the time from a state change to its notification.";
+}
+
 // log-level ///////////////////////////////////////////////////////////////////////////////////////////////
 
 #ifdef USE_LOGGER
 BLECommandLogLevel::BLECommandLogLevel() : BLECommand("log-level", "gets or sets log level (0=None, 4=Config, 5=Debug).") {}
 
-void BLECommandLogLevel::execute(const vector<string>& arguments) const {
+void BLECommandLogLevel::execute(const BLECommandArguments& arguments) const {
   if (!arguments.empty()) {
-    string log_level = arguments[0];
-    const optional<int> level = parse_number<int>(log_level);
+    const optional<int> level = parse_number<int>(arguments[0].str());
     if (level.has_value()) {
       global_ble_controller->set_log_level(level.value());
     }
@@ -166,9 +252,25 @@ void BLECommandLogLevel::execute(const vector<string>& arguments) const {
 BLECustomCommand::BLECustomCommand(const string& name, const string& description, BLEControllerCustomCommandExecutionTrigger* trigger)
  : BLECommand(name, description), trigger(trigger) {}
 
-void BLECustomCommand::execute(const vector<string>& arguments) const {
-  BLECustomCommandResultSender result_sender;
-  trigger->trigger(arguments, result_sender);
+void BLECustomCommand::execute(const BLECommandArguments& arguments) const {
+  // the automation gets its own copies of the arguments
+  vector<string> argument_strings;
+  argument_strings.reserve(arguments.size());
+  for (const auto& argument : arguments) {
+    argument_strings.push_back(argument.str());
+  }
+
+  const uint16_t invocation_id = global_ble_controller->start_command_invocation(trigger);
+  if (invocation_id == 0) {
+    global_ble_controller->send_command_result("Too many running commands, try again later.");
+    return;
+  }
+
+  // the automation runs asynchronously if it contains actions like delays, it marks the invocation as completed at its end
+  trigger->trigger(argument_strings, BLECustomCommandResultSender(invocation_id));
+  if (global_ble_controller->is_command_invocation_running(invocation_id)) {
+    global_ble_controller->send_command_result(invocation_id, string("running"));
+  }
 }
 
 } // namespace esp32_ble_controller
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -13,15 +15,63 @@ namespace esp32_ble_controller {
 
 // generic ///////////////////////////////////////////////////////////////////////////////////////////////
 
+/// Non-owning reference to a part of a string, like a token of the received command line (only valid while the command is executed).
+class BLEStringRef {
+public:
+  BLEStringRef() : data(nullptr), length(0) {}
+  BLEStringRef(const char* data, size_t length) : data(data), length(length) {}
+
+  const char* get_data() const { return data; }
+  size_t size() const { return length; }
+  bool empty() const { return length == 0; }
+  string str() const { return string(data, length); }
+
+  int compare(const string& other) const {
+    const int result = strncmp(data, other.data(), std::min(length, other.length()));
+    return result != 0 ? result : (length < other.length() ? -1 : (length > other.length() ? 1 : 0));
+  }
+  bool operator==(const char* other) const { return strlen(other) == length && memcmp(data, other, length) == 0; }
+  bool operator!=(const char* other) const { return !(*this == other); }
+
+private:
+  const char* data;
+  size_t length;
+};
+
+/// Arguments of a command, i.e. the tokens of the command line after the command name (stored without allocating memory).
+class BLECommandArguments {
+public:
+  static const size_t MAX_ARGUMENTS = 8;
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  const BLEStringRef& operator[](size_t index) const { return arguments[index]; }
+  const BLEStringRef* begin() const { return arguments; }
+  const BLEStringRef* end() const { return arguments + count; }
+
+  /// @return false if there are too many arguments
+  bool add(const BLEStringRef& argument) {
+    if (count == MAX_ARGUMENTS) {
+      return false;
+    }
+    arguments[count++] = argument;
+    return true;
+  }
+
+private:
+  BLEStringRef arguments[MAX_ARGUMENTS];
+  size_t count{0};
+};
+
 class BLECommand {
 public:
   BLECommand(const string& name, const string& description) : name(name), description(description) {}
   virtual ~BLECommand() {}
 
-  const string get_name() const { return name; }
-  const string get_description() const { return description; }
+  const string& get_name() const { return name; }
+  const string& get_description() const { return description; }
 
-  virtual void execute(const std::vector<string>& arguments) const = 0;
+  virtual void execute(const BLECommandArguments& arguments) const = 0;
 
   virtual string get_command_specific_help() const;
   
@@ -40,7 +90,7 @@ public:
   BLECommandHelp();
   virtual ~BLECommandHelp() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 };
 
 // ble-maintenance ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -50,7 +100,7 @@ public:
   BLECommandSwitchMaintenanceOnOrOff();
   virtual ~BLECommandSwitchMaintenanceOnOrOff() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 };
 
 // ble-services ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -60,7 +110,7 @@ public:
   BLECommandSwitchComponentServicesOnOrOff();
   virtual ~BLECommandSwitchComponentServicesOnOrOff() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 };
 
 // wifi-config ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -71,7 +121,7 @@ public:
   BLECommandWifiConfiguration();
   virtual ~BLECommandWifiConfiguration() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 
   virtual string get_command_specific_help() const override;
 };
@@ -84,7 +134,7 @@ public:
   BLECommandPairings();
   virtual ~BLECommandPairings() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 };
 
 // version ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -94,7 +144,49 @@ public:
   BLECommandVersion();
   virtual ~BLECommandVersion() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
+};
+
+// command-latency ///////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLECommandLatency : public BLECommand {
+public:
+  BLECommandLatency();
+  virtual ~BLECommandLatency() {}
+
+  virtual void execute(const BLECommandArguments& arguments) const override;
+};
+
+// connection-profile ///////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLECommandConnectionProfile : public BLECommand {
+public:
+  BLECommandConnectionProfile();
+  virtual ~BLECommandConnectionProfile() {}
+
+  virtual void execute(const BLECommandArguments& arguments) const override;
+};
+
+// connections ///////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLECommandConnections : public BLECommand {
+public:
+  BLECommandConnections();
+  virtual ~BLECommandConnections() {}
+
+  virtual void execute(const BLECommandArguments& arguments) const override;
+};
+
+// stats ///////////////////////////////////////////////////////////////////////////////////////////////
+
+class BLECommandStatistics : public BLECommand {
+public:
+  BLECommandStatistics();
+  virtual ~BLECommandStatistics() {}
+
+  virtual void execute(const BLECommandArguments& arguments) const override;
+
+  virtual string get_command_specific_help() const override;
 };
 
 // log-level ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -105,7 +197,7 @@ public:
   BLECommandLogLevel();
   virtual ~BLECommandLogLevel() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 };
 #endif
 
@@ -118,7 +210,7 @@ public:
   BLECustomCommand(const string& name, const string& description, BLEControllerCustomCommandExecutionTrigger* trigger);
   virtual ~BLECustomCommand() {}
 
-  virtual void execute(const vector<string>& arguments) const override;
+  virtual void execute(const BLECommandArguments& arguments) const override;
 
 private:
   BLEControllerCustomCommandExecutionTrigger* trigger;
@@ -1,7 +1,10 @@
 #include "ble_component_handler_base.h"
 
+#include <cmath>
+
 #include <BLE2902.h>
 
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
 
 #include "esp32_ble_controller.h"
@@ -19,58 +22,213 @@ BLEComponentHandlerBase::BLEComponentHandlerBase(EntityBase* component, const BL
 BLEComponentHandlerBase::~BLEComponentHandlerBase() 
 {}
 
-void BLEComponentHandlerBase::setup(BLEServer* ble_server) {
-  const string& object_id = component->get_object_id();
+void BLEComponentHandlerBase::setup(BLEService* service) {
+  const string object_id = get_object_id();
 
   ESP_LOGCONFIG(TAG, "Setting up BLE characteristic for component %s", object_id.c_str());
 
-  // Get or create the BLE service.
-  const string& service_UUID = characteristic_info.service_UUID;
-  BLEService* service = ble_server->getServiceByUUID(service_UUID);
-  if (service == nullptr) {
-    service = ble_server->createService(service_UUID);
-  }
-
   // Create the BLE characteristic.
-  const string& characteristic_UUID = characteristic_info.characteristic_UUID;
+  BLEUUID characteristic_UUID = to_ble_uuid(characteristic_info.characteristic_UUID);
   if (can_receive_writes()) {
     characteristic = create_writeable_ble_characteristic(service, characteristic_UUID, this, get_component_description(), characteristic_info.use_BLE2902);
   } else {
-    characteristic = create_read_only_ble_characteristic(service, characteristic_UUID, get_component_description(), characteristic_info.use_BLE2902);
+    // lazy values are encoded when read, so we need the read callback
+    characteristic = create_read_only_ble_characteristic(service, characteristic_UUID, get_component_description(), characteristic_info.use_BLE2902, characteristic_info.lazy_value ? this : nullptr);
   }
 
-  service->start();
+  setup_presentation_format();
+
+  // a characteristic created again (see ESP32BLEController::switch_ble_mode()) starts empty, and only lazy values are encoded on read
+  refresh_value();
+
+  ESP_LOGCONFIG(TAG, "%s: SRV %s - CHAR %s", object_id.c_str(), service->getUUID().toString().c_str(), characteristic_UUID.toString().c_str());
+}
+
+void BLEComponentHandlerBase::delete_characteristic() {
+  delete_ble_characteristic(characteristic);
+  characteristic = nullptr;
+}
+
+void BLEComponentHandlerBase::refresh_value() {
+  if (state_encoder) {
+    value_outdated = true;
+    materialize_value();
+  }
+}
 
-  ESP_LOGCONFIG(TAG, "%s: SRV %s - CHAR %s", object_id.c_str(), service_UUID.c_str(), characteristic_UUID.c_str());
+void BLEComponentHandlerBase::setup_presentation_format() {
+  if (characteristic_info.encoding == BLEValueEncoding::PACKED && !supports_packed_encoding()) {
+    ESP_LOGW(TAG, "Packed encoding not supported by component %s, using float", get_object_id().c_str());
+  } else if (characteristic_info.encoding != BLEValueEncoding::DEFAULT) {
+    add_presentation_format_descriptor(characteristic, get_presentation_format(characteristic_info.encoding, characteristic_info.exponent));
+  }
 }
 
 void BLEComponentHandlerBase::send_value(float value) {
+  latest_float_value = value;
+  update_value([this, value]() { encode_value(value); });
+
+  if (!has_listeners()) {
+    skip_notification();
+    return;
+  }
+
   const string& object_id = component->get_object_id();
   ESP_LOGD(TAG, "Update component %s to %f", object_id.c_str(), value);
 
-  characteristic->setValue(value);
-  characteristic->notify();
+  // deadband: the new value can be read, but is not worth a notification
+  const float delta = characteristic_info.notify_delta;
+  if (delta > 0 && has_notified && !std::isnan(value) && !std::isnan(last_notified_float_value) && std::fabs(value - last_notified_float_value) < delta) {
+    count_suppressed_value();
+    return;
+  }
+
+  request_notification();
 }
 
-void BLEComponentHandlerBase::send_value(string value) {
+void BLEComponentHandlerBase::send_value(const string& value) {
+  update_value([this, &value]() { encode_value(value); });
+
+  if (!has_listeners()) {
+    skip_notification();
+    return;
+  }
+
   const string& object_id = component->get_object_id();
   ESP_LOGD(TAG, "Update component %s to %s", object_id.c_str(), value.c_str());
-
-  characteristic->setValue(value);
-  characteristic->notify();
+  request_notification();
 }
 
-void BLEComponentHandlerBase::send_value(bool raw_value) {
+void BLEComponentHandlerBase::send_value(bool value) {
+  update_value([this, value]() { encode_value(value); });
+
+  if (!has_listeners()) {
+    skip_notification();
+    return;
+  }
+
   const string& object_id = component->get_object_id();
-  ESP_LOGD(TAG, "Update component %s to %d", object_id.c_str(), raw_value);
+  ESP_LOGD(TAG, "Update component %s to %d", object_id.c_str(), value);
+  request_notification();
+}
+
+void BLEComponentHandlerBase::encode_value(float value) {
+  uint8_t encoded_value[BLE_MAX_ENCODED_FLOAT_SIZE];
+  const size_t length = encode_float_value(value, characteristic_info.encoding, characteristic_info.exponent, encoded_value);
+  characteristic->setValue(encoded_value, length);
+}
 
-  uint16_t value = raw_value;
+void BLEComponentHandlerBase::encode_value(const string& value) {
   characteristic->setValue(value);
-  characteristic->notify();
+}
+
+void BLEComponentHandlerBase::encode_value(bool value) {
+  if (characteristic_info.encoding == BLEValueEncoding::DEFAULT) {
+    uint16_t raw_value = value;
+    characteristic->setValue(raw_value);
+  } else {
+    uint8_t encoded_value[BLE_MAX_ENCODED_FLOAT_SIZE];
+    const size_t length = encode_float_value(value ? 1 : 0, characteristic_info.encoding, characteristic_info.exponent, encoded_value);
+    characteristic->setValue(encoded_value, length);
+  }
+}
+
+void BLEComponentHandlerBase::set_state_encoder(std::function<void()>&& encoder, bool callable_from_any_task) {
+  state_encoder = std::move(encoder);
+  state_encoder_callable_from_any_task = callable_from_any_task;
+}
+
+template <typename F> void BLEComponentHandlerBase::update_value(F&& encode) {
+  if (characteristic == nullptr) {
+    return; // the service has been removed, setup() stores the current state again
+  }
+  if (is_lazy()) {
+    value_outdated = true; // encoded on demand
+  } else {
+    encode();
+  }
+}
+
+void BLEComponentHandlerBase::materialize_value() {
+  LockGuard guard(value_mutex);
+  if (value_outdated && characteristic != nullptr) {
+    value_outdated = false;
+    state_encoder();
+  }
+}
+
+void BLEComponentHandlerBase::materialize_value_if_connected() {
+  if (global_ble_controller->get_connection_count() > 0) {
+    materialize_value();
+  }
+}
+
+void BLEComponentHandlerBase::onRead(BLECharacteristic *characteristic) {
+  // called in the BLE task, values that cannot be encoded here are encoded in the loop instead (see loop())
+  if (value_outdated && state_encoder_callable_from_any_task) {
+    materialize_value();
+  }
+}
+
+bool BLEComponentHandlerBase::has_listeners() {
+  return global_ble_controller->has_listeners(characteristic, characteristic_info.notify_unsubscribed);
+}
+
+void BLEComponentHandlerBase::skip_notification() {
+  count_suppressed_value();
+  notify_pending = false;
+  has_notified = false;
+}
+
+void BLEComponentHandlerBase::request_notification() {
+  if (notify_pending) {
+    count_suppressed_value(); // the pending value is replaced by the new one
+  }
+  schedule_notification();
+  notify_if_interval_elapsed();
+}
+
+void BLEComponentHandlerBase::schedule_notification() {
+  if (!notify_pending) {
+    notify_pending = true;
+    notify_pending_since_micros = micros();
+  }
+}
+
+void BLEComponentHandlerBase::notify_if_interval_elapsed() {
+  const uint32_t now = millis();
+  if (has_notified && now - last_notify_millis < characteristic_info.min_notify_interval_ms) {
+    return; // the latest value is sent from the loop once the interval has elapsed
+  }
+
+  if (send_notification()) {
+    statistics.notify_latency.record(micros() - notify_pending_since_micros);
+  }
+  notify_pending = false;
+  has_notified = true;
+  last_notify_millis = now;
+  last_notified_float_value = latest_float_value;
+}
+
+bool BLEComponentHandlerBase::send_notification() {
+  if (value_outdated) {
+    materialize_value();
+  }
+  return notify_listeners();
+}
+
+bool BLEComponentHandlerBase::notify_listeners() {
+  return global_ble_controller->notify(characteristic, characteristic_info.notify_unsubscribed, &statistics.traffic);
 }
 
 void BLEComponentHandlerBase::onWrite(BLECharacteristic *characteristic) {
-  global_ble_controller->execute_in_loop([this](){ on_characteristic_written(); });
+  ++statistics.writes_received;
+  global_ble_controller->execute_in_loop([this](){
+    // the characteristic is gone if its service has been removed in the meantime
+    if (this->characteristic != nullptr) {
+      on_characteristic_written();
+    }
+  }, this);
 }
 
 bool BLEComponentHandlerBase::is_security_enabled() {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <string>
 
 #include <BLEServer.h>
@@ -8,16 +9,57 @@
 #include "esphome/core/entity_base.h"
 #include "esphome/core/controller.h"
 #include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
+
+#include "ble_statistics.h"
+#include "ble_value_encoding.h"
 
 using std::string;
 
 namespace esphome {
 namespace esp32_ble_controller {
 
+/// Binary representation of a 16, 32 or 128 bit UUID (most significant byte first, i.e. in the order of the string representation).
+struct BLEUUIDBytes {
+  /// number of valid bytes: 2, 4 or 16
+  uint8_t length;
+  uint8_t bytes[16];
+};
+
+/// Kind of component exposed by a characteristic, determines the handler for the component.
+enum class BLEComponentKind : uint8_t { UNSUPPORTED, BINARY_SENSOR, FAN, SENSOR, SWITCH, TEXT_SENSOR };
+
+/**
+ * Describes the characteristic that exposes a component.
+ * Instances are generated as constant table by the code generation, so they reside in flash and need no parsing at runtime.
+ */
 struct BLECharacteristicInfoForHandler {
-  string service_UUID;
-  string characteristic_UUID;
+  BLEUUIDBytes service_UUID;
+  BLEUUIDBytes characteristic_UUID;
   bool use_BLE2902;
+  /// true if notifications are sent to all connected clients, even if they have not subscribed via the 0x2902 descriptor (for clients like the homebridge plug-in)
+  bool notify_unsubscribed;
+  /// minimum time between two notifications, value changes in between are coalesced (latest value wins)
+  uint32_t min_notify_interval_ms;
+  /// minimum change of a float value compared to the last notified value that triggers a notification (deadband)
+  float notify_delta;
+  BLEValueEncoding encoding;
+  /// decimal exponent for scaled integer encodings
+  int8_t exponent;
+  /// true if the value is only encoded when a client reads it or a notification is due (instead of on every state change)
+  bool lazy_value;
+  /// true if the characteristic aggregates the values of several components (all registered with this info) into one frame
+  bool is_aggregate;
+};
+
+/**
+ * Describes a service that contains characteristics exposing components.
+ * Instances are generated as constant table by the code generation, which knows all characteristics of the service in advance.
+ */
+struct BLEServiceInfo {
+  BLEUUIDBytes UUID;
+  /// number of attribute handles of the service: service declaration, declaration and value of each characteristic, and one per descriptor
+  uint16_t num_handles;
 };
 
 /**
@@ -33,29 +75,117 @@ public:
   BLEComponentHandlerBase(EntityBase* component, const BLECharacteristicInfoForHandler& characteristic_info);
   virtual ~BLEComponentHandlerBase();
 
-  void setup(BLEServer* ble_server);
+  /// Creates the characteristic in the given service (which is started later, once all its characteristics are known).
+  void setup(BLEService* service);
+  /// Deletes the characteristic after its service has been removed, state changes are not encoded until setup() is called again.
+  void delete_characteristic();
 
   virtual void send_value(float value);
-  virtual void send_value(string value);
+  virtual void send_value(const string& value);
   virtual void send_value(bool value);
 
+  /// Encodes the given state into the value of the characteristic (without notifying).
+  virtual void encode_value(float value);
+  virtual void encode_value(const string& value);
+  virtual void encode_value(bool value);
+
+  /**
+   * Sets the function that encodes the current state of the component, which is required for lazy values.
+   * @param callable_from_any_task true if the function may be called from the BLE task when a client reads the value, otherwise the value is encoded in the loop while a client is connected
+   */
+  void set_state_encoder(std::function<void()>&& encoder, bool callable_from_any_task);
+
+  /// Sends the notification that was held back due to the minimum notify interval (if any and if the interval has elapsed).
+  inline void send_pending_notification() {
+    if (notify_pending) {
+      notify_if_interval_elapsed();
+    }
+    if (value_outdated && !state_encoder_callable_from_any_task) {
+      materialize_value_if_connected();
+    }
+  }
+
+  const BLECharacteristicInfoForHandler& get_characteristic_info() const { return characteristic_info; }
+
+  virtual string get_object_id() { return get_component()->get_object_id(); }
+
+  const BLEHandlerStatistics& get_statistics() const { return statistics; }
+  void reset_statistics() { statistics = BLEHandlerStatistics(); }
+
 protected:
   virtual EntityBase* get_component() { return component; }
   virtual string get_component_description() { return get_component()->get_name(); }
   BLECharacteristic* get_characteristic() { return characteristic; }
 
   virtual bool can_receive_writes() { return false; }
+  virtual bool supports_packed_encoding() { return false; }
   virtual void on_characteristic_written() {}
+  /// Adds the presentation format descriptor (0x2904) matching the encoding (if any).
+  virtual void setup_presentation_format();
+  /// Stores the current state in the characteristic (at the end of setup()).
+  virtual void refresh_value();
+  /// Marks the value as outdated, the state encoder stores the current state later (in the loop while a client is connected, or before a notification).
+  void mark_value_outdated() { value_outdated = true; }
 
   bool is_security_enabled();
+
+  /// @return true if a connected client receives notifications of the characteristic
+  bool has_listeners();
+  /// Forgets about pending notifications while nobody listens, so that the next value is notified once somebody does.
+  void skip_notification();
+
+  /// Notifies the client about the current value of the characteristic, respecting the minimum notify interval.
+  void request_notification();
+  /// Marks a notification as pending without sending it, it is sent from the loop respecting the minimum notify interval.
+  void schedule_notification();
+  /**
+   * Sends the current value of the characteristic to the subscribed clients.
+   * @return true if a notification has been sent to at least one client
+   */
+  virtual bool send_notification();
+  /**
+   * Sends the current value of the characteristic as notification to the listeners (see ESP32BLEController::notify()) and counts it.
+   * @return true if the notification has been sent to at least one client
+   */
+  bool notify_listeners();
+  /// Counts a state change that is not notified.
+  void count_suppressed_value() { ++statistics.values_suppressed; }
   
 private:
   virtual void onWrite(BLECharacteristic *characteristic); // inherited from BLECharacteristicCallbacks
+  virtual void onRead(BLECharacteristic *characteristic); // inherited from BLECharacteristicCallbacks
+
+  void notify_if_interval_elapsed();
+
+  inline bool is_lazy() const { return characteristic_info.lazy_value && state_encoder; }
+  /// Encodes the value right away or marks it as outdated for lazy values.
+  template <typename F> void update_value(F&& encode);
+  /// Encodes the current state if the value is outdated.
+  void materialize_value();
+  /// Encodes lazy values that cannot be encoded in the BLE task (in the loop, as long as a client might read them).
+  void materialize_value_if_connected();
 
   EntityBase* component;
-  BLECharacteristicInfoForHandler characteristic_info;
+  const BLECharacteristicInfoForHandler& characteristic_info;
+
+  BLECharacteristic* characteristic{nullptr};
+
+  bool notify_pending{false};
+  /// time of the state change that made the notification pending (for the latency statistics)
+  uint32_t notify_pending_since_micros{0};
+  bool has_notified{false};
+  uint32_t last_notify_millis{0};
+  float latest_float_value{0};
+  float last_notified_float_value{0};
+
+  std::function<void()> state_encoder;
+  bool state_encoder_callable_from_any_task{false};
+  /// true if the state has changed since the value has been encoded (lazy values and aggregates only)
+  volatile bool value_outdated{false};
+  /// guards encoding lazy values, which may happen in the loop and in the BLE task
+  Mutex value_mutex;
 
-  BLECharacteristic* characteristic;
+  BLEHandlerStatistics statistics;
 };
 
 } // namespace esp32_ble_controller
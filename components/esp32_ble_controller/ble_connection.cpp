@@ -0,0 +1,275 @@
+#include "ble_connection.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+// profiles ///////////////////////////////////////////////////////////////////////////////////////////////
+
+// keep in sync with CONNECTION_PROFILE_DEFAULTS in __init__.py
+static const BLEConnectionParameters DEFAULT_CONNECTION_PARAMETERS[BLE_CONNECTION_PROFILE_COUNT] = {
+  { 6, 12, 0, 200, 32, 64, 3 }, // low-latency: 7.5-15ms, timeout 2s, advertising 20-40ms, +3dBm
+  { 24, 40, 0, 400, 160, 240, 3 }, // balanced: 30-50ms, timeout 4s, advertising 100-150ms, +3dBm
+  { 80, 160, 4, 600, 1600, 2048, -6 }, // low-power: 100-200ms, 4 skipped events, timeout 6s, advertising 1-1.28s, -6dBm
+};
+
+static const char* const CONNECTION_PROFILE_NAMES[BLE_CONNECTION_PROFILE_COUNT] = { "low-latency", "balanced", "low-power" };
+
+const BLEConnectionParameters& get_default_connection_parameters(BLEConnectionProfile profile) {
+  return DEFAULT_CONNECTION_PARAMETERS[static_cast<uint8_t>(profile)];
+}
+
+const char* get_connection_profile_name(BLEConnectionProfile profile) {
+  return CONNECTION_PROFILE_NAMES[static_cast<uint8_t>(profile)];
+}
+
+// connections ///////////////////////////////////////////////////////////////////////////////////////////////
+
+uint16_t BLEConnectionContext::get_subscription(uint16_t descriptor_handle) const {
+  for (const auto& subscription : subscriptions) {
+    if (subscription.first == descriptor_handle) {
+      return subscription.second;
+    }
+  }
+  return 0;
+}
+
+bool BLEConnectionRegistry::add(uint16_t conn_id, const esp_bd_addr_t address) {
+  LockGuard guard(mutex);
+
+  if (connections.size() >= max_connections) {
+    return false;
+  }
+
+  BLEConnectionContext connection;
+  connection.conn_id = conn_id;
+  memcpy(connection.address, address, sizeof(connection.address));
+  connections.push_back(connection);
+  return true;
+}
+
+bool BLEConnectionRegistry::remove(uint16_t conn_id) {
+  LockGuard guard(mutex);
+  auto it = std::find_if(connections.begin(), connections.end(), [conn_id](const BLEConnectionContext& connection) { return connection.conn_id == conn_id; });
+  if (it == connections.end()) {
+    return false;
+  }
+
+  if (it->authenticated) {
+    const esp_bd_addr_t& address = it->address;
+    bonded_subscriptions.erase(std::remove_if(bonded_subscriptions.begin(), bonded_subscriptions.end(), [&address](const BLEBondedSubscriptions& bonded) {
+      return memcmp(bonded.address, address, sizeof(bonded.address)) == 0;
+    }), bonded_subscriptions.end());
+    if (!it->subscriptions.empty()) {
+      if (bonded_subscriptions.size() == BLE_MAX_BONDED_SUBSCRIPTIONS) {
+        bonded_subscriptions.erase(bonded_subscriptions.begin());
+      }
+      bonded_subscriptions.emplace_back();
+      memcpy(bonded_subscriptions.back().address, address, sizeof(address));
+      bonded_subscriptions.back().subscriptions = std::move(it->subscriptions);
+    }
+  }
+
+  connections.erase(it);
+  return true;
+}
+
+void BLEConnectionRegistry::clear() {
+  LockGuard guard(mutex);
+  connections.clear();
+  bonded_subscriptions.clear();
+  subscription_descriptors.clear();
+}
+
+void BLEConnectionRegistry::clear_bonded_subscriptions() {
+  LockGuard guard(mutex);
+  bonded_subscriptions.clear();
+}
+
+void BLEConnectionRegistry::set_mtu(uint16_t conn_id, uint16_t mtu) {
+  LockGuard guard(mutex);
+  BLEConnectionContext* connection = find(conn_id);
+  if (connection != nullptr) {
+    connection->mtu = mtu;
+  }
+}
+
+void BLEConnectionRegistry::set_data_length_requested(uint16_t conn_id) {
+  LockGuard guard(mutex);
+  BLEConnectionContext* connection = find(conn_id);
+  if (connection != nullptr) {
+    connection->data_length_pending = true;
+  }
+}
+
+void BLEConnectionRegistry::complete_data_length_request(bool success, uint16_t data_length) {
+  LockGuard guard(mutex);
+  for (auto& connection : connections) {
+    if (connection.data_length_pending) {
+      connection.data_length_pending = false;
+      if (success) {
+        connection.data_length = data_length;
+      }
+      return;
+    }
+  }
+}
+
+void BLEConnectionRegistry::set_authenticated(const esp_bd_addr_t address, bool authenticated) {
+  LockGuard guard(mutex);
+  for (auto& connection : connections) {
+    if (memcmp(connection.address, address, sizeof(connection.address)) == 0) {
+      connection.authenticated = authenticated;
+    }
+  }
+  if (!authenticated) {
+    return;
+  }
+
+  // a bonded client need not write the descriptors again when it reconnects
+  auto bonded = std::find_if(bonded_subscriptions.begin(), bonded_subscriptions.end(), [address](const BLEBondedSubscriptions& bonded) {
+    return memcmp(bonded.address, address, sizeof(bonded.address)) == 0;
+  });
+  if (bonded == bonded_subscriptions.end()) {
+    return;
+  }
+  for (auto& connection : connections) {
+    if (memcmp(connection.address, address, sizeof(connection.address)) == 0) {
+      for (const auto& subscription : bonded->subscriptions) {
+        const bool written = std::any_of(connection.subscriptions.begin(), connection.subscriptions.end(), [&subscription](const pair<uint16_t, uint16_t>& entry) {
+          return entry.first == subscription.first;
+        });
+        if (!written) {
+          connection.subscriptions.push_back(subscription);
+        }
+      }
+    }
+  }
+  bonded_subscriptions.erase(bonded);
+}
+
+void BLEConnectionRegistry::add_subscription_descriptor(uint16_t descriptor_handle) {
+  LockGuard guard(mutex);
+  if (std::find(subscription_descriptors.begin(), subscription_descriptors.end(), descriptor_handle) == subscription_descriptors.end()) {
+    subscription_descriptors.push_back(descriptor_handle);
+  }
+}
+
+void BLEConnectionRegistry::record_write(uint16_t conn_id, uint16_t handle, const uint8_t* value, size_t length) {
+  if (length != 2) { // client characteristic configuration descriptors have two bytes
+    return;
+  }
+
+  LockGuard guard(mutex);
+  if (std::find(subscription_descriptors.begin(), subscription_descriptors.end(), handle) == subscription_descriptors.end()) {
+    return; // an ordinary write, e.g. of a characteristic with a 16-bit value
+  }
+
+  BLEConnectionContext* connection = find(conn_id);
+  if (connection == nullptr) {
+    return;
+  }
+
+  const uint16_t subscription = value[0] | (value[1] << 8);
+  for (auto& entry : connection->subscriptions) {
+    if (entry.first == handle) {
+      entry.second = subscription;
+      return;
+    }
+  }
+  connection->subscriptions.emplace_back(handle, subscription);
+}
+
+void BLEConnectionRegistry::remove_subscriptions(uint16_t first_handle, uint16_t last_handle) {
+  LockGuard guard(mutex);
+  auto in_range = [first_handle, last_handle](const pair<uint16_t, uint16_t>& subscription) {
+    return subscription.first >= first_handle && subscription.first <= last_handle;
+  };
+  for (auto& connection : connections) {
+    auto& subscriptions = connection.subscriptions;
+    subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(), in_range), subscriptions.end());
+  }
+  for (auto& bonded : bonded_subscriptions) {
+    auto& subscriptions = bonded.subscriptions;
+    subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(), in_range), subscriptions.end());
+  }
+  subscription_descriptors.erase(std::remove_if(subscription_descriptors.begin(), subscription_descriptors.end(),
+    [first_handle, last_handle](uint16_t handle) { return handle >= first_handle && handle <= last_handle; }), subscription_descriptors.end());
+}
+
+size_t BLEConnectionRegistry::get_count() const {
+  LockGuard guard(mutex);
+  return connections.size();
+}
+
+vector<BLEConnectionContext> BLEConnectionRegistry::get_connections() const {
+  LockGuard guard(mutex);
+  return connections;
+}
+
+uint16_t BLEConnectionRegistry::get_mtu(uint16_t conn_id) const {
+  LockGuard guard(mutex);
+  const BLEConnectionContext* connection = find(conn_id);
+  return connection != nullptr ? std::max<uint16_t>(connection->mtu, ESP_GATT_DEF_BLE_MTU_SIZE) : ESP_GATT_DEF_BLE_MTU_SIZE;
+}
+
+uint16_t BLEConnectionRegistry::get_min_mtu() const {
+  LockGuard guard(mutex);
+
+  if (connections.empty()) {
+    return ESP_GATT_DEF_BLE_MTU_SIZE;
+  }
+  uint16_t mtu = ESP_GATT_MAX_MTU_SIZE;
+  for (const auto& connection : connections) {
+    mtu = std::min(mtu, connection.mtu);
+  }
+  return std::max<uint16_t>(mtu, ESP_GATT_DEF_BLE_MTU_SIZE);
+}
+
+bool BLEConnectionRegistry::has_notification_targets(uint16_t descriptor_handle) const {
+  LockGuard guard(mutex);
+  for (const auto& connection : connections) {
+    if (descriptor_handle == 0 || (connection.get_subscription(descriptor_handle) & BLE_CCCD_NOTIFY)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t BLEConnectionRegistry::get_notification_targets(uint16_t descriptor_handle, BLENotificationTarget (&targets)[BLE_MAX_CONNECTIONS], uint16_t subscription) const {
+  LockGuard guard(mutex);
+
+  size_t count = 0;
+  for (const auto& connection : connections) {
+    if (count == BLE_MAX_CONNECTIONS) {
+      break;
+    }
+    if (descriptor_handle == 0 || (connection.get_subscription(descriptor_handle) & subscription)) {
+      targets[count++] = { connection.conn_id, static_cast<size_t>(std::max<uint16_t>(connection.mtu, ESP_GATT_DEF_BLE_MTU_SIZE) - 3) };
+    }
+  }
+  return count;
+}
+
+BLEConnectionContext* BLEConnectionRegistry::find(uint16_t conn_id) {
+  for (auto& connection : connections) {
+    if (connection.conn_id == conn_id) {
+      return &connection;
+    }
+  }
+  return nullptr;
+}
+
+const BLEConnectionContext* BLEConnectionRegistry::find(uint16_t conn_id) const {
+  for (const auto& connection : connections) {
+    if (connection.conn_id == conn_id) {
+      return &connection;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <esp_gatt_defs.h>
+
+#include "esphome/core/helpers.h"
+
+using std::pair;
+using std::vector;
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/// Maximum number of simultaneous connections (default of the BLE controller configuration of the ESP32 Arduino core).
+static const size_t BLE_MAX_CONNECTIONS = 3;
+
+/// Bit of the client characteristic configuration descriptor (0x2902) for notifications.
+static const uint16_t BLE_CCCD_NOTIFY = 1 << 0;
+/// Bit of the client characteristic configuration descriptor (0x2902) for indications.
+static const uint16_t BLE_CCCD_INDICATE = 1 << 1;
+
+/// Named tradeoff between latency and power consumption, applied to connections and advertising.
+enum class BLEConnectionProfile : uint8_t { LOW_LATENCY = 0, BALANCED = 1, LOW_POWER = 2 };
+
+/// Number of connection profiles.
+static const size_t BLE_CONNECTION_PROFILE_COUNT = 3;
+
+/// Parameters of a connection profile (in the units of the Bluetooth specification).
+struct BLEConnectionParameters {
+  /// minimum connection interval (in 1.25ms)
+  uint16_t min_interval;
+  /// maximum connection interval (in 1.25ms)
+  uint16_t max_interval;
+  /// number of connection events the peripheral may skip
+  uint16_t latency;
+  /// supervision timeout (in 10ms)
+  uint16_t timeout;
+  /// minimum advertising interval (in 0.625ms)
+  uint16_t min_advertising_interval;
+  /// maximum advertising interval (in 0.625ms)
+  uint16_t max_advertising_interval;
+  /// transmit power (in dBm, -12 to 9 in steps of 3)
+  int8_t tx_power;
+};
+
+/// @return the built-in parameters of the given profile
+const BLEConnectionParameters& get_default_connection_parameters(BLEConnectionProfile profile);
+/// @return the name of the given profile, like "low-latency"
+const char* get_connection_profile_name(BLEConnectionProfile profile);
+
+/// Default maximum payload of a link layer packet (without Data Length Extension).
+static const uint16_t BLE_DEFAULT_DATA_LENGTH = 27;
+
+/// State of the connection with a single client.
+struct BLEConnectionContext {
+  uint16_t conn_id;
+  esp_bd_addr_t address;
+  uint16_t mtu{ESP_GATT_DEF_BLE_MTU_SIZE};
+  /// maximum payload of a link layer packet sent to the client (see Data Length Extension)
+  uint16_t data_length{BLE_DEFAULT_DATA_LENGTH};
+  /// true while a change of the data length has been requested, but not yet completed
+  bool data_length_pending{false};
+  bool authenticated{false};
+  /// Values of the client characteristic configuration descriptors written by this client, by attribute handle.
+  vector<pair<uint16_t, uint16_t>> subscriptions;
+
+  /// @return the value of the client characteristic configuration descriptor with the given handle (0 if never written)
+  uint16_t get_subscription(uint16_t descriptor_handle) const;
+};
+
+/// Maximum number of bonded clients whose subscriptions are kept while they are disconnected.
+static const size_t BLE_MAX_BONDED_SUBSCRIPTIONS = 8;
+
+/// Subscriptions of a bonded client that is not connected (the client characteristic configuration persists across connections of bonded clients).
+struct BLEBondedSubscriptions {
+  esp_bd_addr_t address;
+  vector<pair<uint16_t, uint16_t>> subscriptions;
+};
+
+/// Client of a notification: connection and maximum size of the value.
+struct BLENotificationTarget {
+  uint16_t conn_id;
+  size_t max_size;
+};
+
+/**
+ * Keeps track of the connected clients, their MTU, security state, and subscriptions.
+ * It is updated from the GATT server events (in the BLE task) and queried from the main loop, so all methods are thread-safe.
+ * @brief Registry of the connections with clients
+ */
+class BLEConnectionRegistry {
+public:
+  void set_max_connections(size_t max) { max_connections = max; }
+  size_t get_max_connections() const { return max_connections; }
+
+  /// @return false if the maximum number of connections has been reached
+  bool add(uint16_t conn_id, const esp_bd_addr_t address);
+  /**
+   * Removes the connection, the subscriptions of an authenticated (i.e. bonded) client are kept until it reconnects.
+   * @return false if there is no such connection (e.g. it has been rejected)
+   */
+  bool remove(uint16_t conn_id);
+  /// Forgets all connections, kept subscriptions and descriptors (when BLE is shut down).
+  void clear();
+  /// Forgets the kept subscriptions of bonded clients (when the bonds are removed).
+  void clear_bonded_subscriptions();
+
+  void set_mtu(uint16_t conn_id, uint16_t mtu);
+  /// Records that a change of the data length has been requested for the connection.
+  void set_data_length_requested(uint16_t conn_id);
+  /**
+   * Records the completion of the oldest pending data length request.
+   * (The stack does not tell the connection, but completes the requests in order.)
+   */
+  void complete_data_length_request(bool success, uint16_t data_length);
+  /// Records the result of the authentication, a bonded client gets back the subscriptions of its previous connection.
+  void set_authenticated(const esp_bd_addr_t address, bool authenticated);
+  /// Registers the handle of a client characteristic configuration descriptor (0x2902) added to the GATT server.
+  void add_subscription_descriptor(uint16_t descriptor_handle);
+  /// Records a write of the client as subscription if the handle is one of a client characteristic configuration descriptor.
+  void record_write(uint16_t conn_id, uint16_t handle, const uint8_t* value, size_t length);
+  /// Forgets the descriptors and the subscriptions (incl. the kept ones) in the given range of handles (of a removed service).
+  void remove_subscriptions(uint16_t first_handle, uint16_t last_handle);
+
+  size_t get_count() const;
+  /// @return a copy of the state of all connections
+  vector<BLEConnectionContext> get_connections() const;
+  /// @return the MTU of the given connection (the default MTU if there is no such connection)
+  uint16_t get_mtu(uint16_t conn_id) const;
+  /// @return the smallest MTU of all connections (the default MTU if there is none)
+  uint16_t get_min_mtu() const;
+
+  /// @return true if a client has subscribed to notifications via the descriptor with the given handle (any client if handle 0)
+  bool has_notification_targets(uint16_t descriptor_handle) const;
+
+  /**
+   * Collects the clients which have subscribed to notifications via the descriptor with the given handle (all clients if there is no such descriptor, i.e. handle 0).
+   * @param subscription the bit of the descriptor value the clients must have set (BLE_CCCD_NOTIFY or BLE_CCCD_INDICATE)
+   * @return the number of targets written to the array
+   */
+  size_t get_notification_targets(uint16_t descriptor_handle, BLENotificationTarget (&targets)[BLE_MAX_CONNECTIONS], uint16_t subscription = BLE_CCCD_NOTIFY) const;
+
+private:
+  BLEConnectionContext* find(uint16_t conn_id);
+  const BLEConnectionContext* find(uint16_t conn_id) const;
+
+  mutable Mutex mutex;
+  size_t max_connections{1};
+  vector<BLEConnectionContext> connections;
+  /// subscriptions of disconnected bonded clients, the most recently disconnected one last
+  vector<BLEBondedSubscriptions> bonded_subscriptions;
+  /// handles of the client characteristic configuration descriptors, only writes of these are subscriptions
+  vector<uint16_t> subscription_descriptors;
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
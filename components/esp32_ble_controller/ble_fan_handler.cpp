@@ -2,6 +2,8 @@
 
 #ifdef USE_FAN
 
+#include <cstring>
+
 #include "ble_utils.h"
 
 namespace esphome {
@@ -18,7 +20,12 @@ static const char *OPT_OSCILLATING_NO = "no";
 static const char *OPT_DIRECTION_FWD = "forward";
 static const char *OPT_DIRECTION_REV = "reverse";
 
-void BLEFanHandler::send_value(bool on_off) {
+void BLEFanHandler::encode_value(bool on_off) {
+  if (get_characteristic_info().encoding == BLEValueEncoding::PACKED) {
+    encode_packed_value(on_off);
+    return;
+  }
+
   string state_as_string;
 
   state_as_string = "fan=";
@@ -47,7 +54,29 @@ void BLEFanHandler::send_value(bool on_off) {
     state_as_string += fan->direction == fan::FanDirection::FORWARD ? OPT_DIRECTION_FWD : OPT_DIRECTION_REV;
   }
 
-  BLEComponentHandlerBase::send_value(state_as_string);
+  BLEComponentHandlerBase::encode_value(state_as_string);
+}
+
+void BLEFanHandler::encode_packed_value(bool on_off) {
+  /*const*/ Fan* fan = get_component();
+  const auto& traits = fan->get_traits();
+
+  BLEFanPackedState state{};
+  if (on_off) {
+    state.flags |= BLEFanPackedState::FLAG_ON;
+  }
+  if (traits.supports_oscillation() && fan->oscillating) {
+    state.flags |= BLEFanPackedState::FLAG_OSCILLATING;
+  }
+  if (traits.supports_direction() && fan->direction == fan::FanDirection::REVERSE) {
+    state.flags |= BLEFanPackedState::FLAG_REVERSE;
+  }
+  if (traits.supports_speed()) {
+    state.speed = fan->speed;
+    state.speed_count = traits.supported_speed_count();
+  }
+
+  get_characteristic()->setValue(reinterpret_cast<uint8_t*>(&state), sizeof(state));
 }
 
 void BLEFanHandler::on_characteristic_written() {
@@ -55,6 +84,11 @@ void BLEFanHandler::on_characteristic_written() {
 
   Fan* fan = get_component();
 
+  if (get_characteristic_info().encoding == BLEValueEncoding::PACKED && value.length() == sizeof(BLEFanPackedState)) {
+    on_packed_characteristic_written(value);
+    return;
+  }
+
   // for backward compatibility
   if (value.length() == 1) {
     uint8_t on = value[0];
@@ -116,6 +150,28 @@ void BLEFanHandler::on_characteristic_written() {
   call.perform();
 }
 
+void BLEFanHandler::on_packed_characteristic_written(const std::string& value) {
+  BLEFanPackedState state;
+  memcpy(&state, value.data(), sizeof(state));
+  ESP_LOGD(TAG, "Fan chracteristic written: flags %d, speed %d", state.flags, state.speed);
+
+  Fan* fan = get_component();
+  const auto& traits = fan->get_traits();
+
+  auto call = fan->make_call();
+  call.set_state(state.flags & BLEFanPackedState::FLAG_ON);
+  if (traits.supports_speed() && state.speed <= traits.supported_speed_count()) {
+    call.set_speed(state.speed);
+  }
+  if (traits.supports_oscillation()) {
+    call.set_oscillating(state.flags & BLEFanPackedState::FLAG_OSCILLATING);
+  }
+  if (traits.supports_direction()) {
+    call.set_direction(state.flags & BLEFanPackedState::FLAG_REVERSE ? fan::FanDirection::REVERSE : fan::FanDirection::FORWARD);
+  }
+  call.perform();
+}
+
 } // namespace esp32_ble_controller
 } // namespace esphome
 
@@ -16,19 +16,37 @@ namespace esp32_ble_controller {
 
 using fan::Fan;
 
+/// Packed binary representation of the fan state.
+struct BLEFanPackedState {
+  static const uint8_t FLAG_ON = 1 << 0;
+  static const uint8_t FLAG_OSCILLATING = 1 << 1;
+  static const uint8_t FLAG_REVERSE = 1 << 2;
+
+  uint8_t flags;
+  uint8_t speed;
+  /// number of supported speeds (0 if speed is not supported), read-only
+  uint8_t speed_count;
+} __attribute__((packed));
+
 /**
  * Special component handler for fans, which allows turning the fan on and off from a BLE client.
+ * By default the state is represented as string, with packed encoding it is represented by a BLEFanPackedState structure.
  */
 class BLEFanHandler : public BLEComponentHandler<Fan> {
 public:
   BLEFanHandler(Fan* component, const BLECharacteristicInfoForHandler& characteristic_info) : BLEComponentHandler(component, characteristic_info) {}
   virtual ~BLEFanHandler() {}
 
-  virtual void send_value(bool value) override;
+  virtual void encode_value(bool value) override;
 
 protected:
   virtual bool can_receive_writes() { return true; }
+  virtual bool supports_packed_encoding() override { return true; }
   virtual void on_characteristic_written() override;
+
+private:
+  void encode_packed_value(bool on_off);
+  void on_packed_characteristic_written(const std::string& value);
 };
 
 } // namespace esp32_ble_controller
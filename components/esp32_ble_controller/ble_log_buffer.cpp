@@ -0,0 +1,142 @@
+#include "ble_log_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+void BLELogBuffer::set_capacity(size_t capacity) {
+  LockGuard guard(mutex);
+  buffer.resize(capacity);
+  head = 0;
+  used = 0;
+}
+
+/**
+ * Passes the characters of the log message without the magic logger symbols to the given output in a single pass.
+ * Note: We do not use regex replacement because it enlarges the binary by roughly 50kb!
+ * @param skip_header if true the header of the message ("[D][tag:123]: ") is skipped as well, a message without a complete header is passed in full
+ */
+template <typename Output>
+static void filter_log_message(const char* message, bool skip_header, Output&& output) {
+  if (skip_header && strstr(message, "]: ") == nullptr) {
+    skip_header = false;
+  }
+  enum { START, TEXT, HEADER, HEADER_BRACKET, HEADER_COLON } state = skip_header ? START : TEXT;
+  bool within_magic = false;
+
+  for (const char* p = message; *p != '\0'; ++p) {
+    const char c = *p;
+    if (within_magic) {
+      within_magic = (c != 'm');
+      continue;
+    }
+    if (c == '\033' && p[1] == '[') { // log magic always starts with "\033[" see log.h
+      within_magic = true;
+      ++p;
+      continue;
+    }
+
+    switch (state) {
+      case START:
+        state = (c == '[') ? HEADER : TEXT;
+        if (state == TEXT) {
+          break;
+        }
+        continue;
+      case HEADER: // the header ends with "]: "
+        if (c == ']') {
+          state = HEADER_BRACKET;
+        }
+        continue;
+      case HEADER_BRACKET:
+        state = (c == ':') ? HEADER_COLON : (c == ']') ? HEADER_BRACKET : HEADER;
+        continue;
+      case HEADER_COLON:
+        state = (c == ' ') ? TEXT : HEADER;
+        continue;
+      case TEXT:
+        break;
+    }
+
+    output(c);
+  }
+}
+
+bool BLELogBuffer::add_log_message(const char* message, int level, const char* tag, bool binary_prefix) {
+  const size_t tag_length = binary_prefix ? std::min<size_t>(strlen(tag), UINT8_MAX) : 0;
+  const size_t prefix_length = binary_prefix ? 2 + tag_length : 0;
+  // upper bound, the filtered message may be shorter
+  const size_t max_length = prefix_length + strlen(message);
+
+  LockGuard guard(mutex);
+
+  if (max_length > UINT16_MAX || LENGTH_PREFIX_SIZE + max_length > buffer.size() - used) {
+    ++dropped_count;
+    return false;
+  }
+
+  // write the line behind the length prefix first, the length is known afterwards
+  size_t length = 0;
+  if (binary_prefix) {
+    write_at(LENGTH_PREFIX_SIZE + length++, static_cast<uint8_t>(level));
+    write_at(LENGTH_PREFIX_SIZE + length++, static_cast<uint8_t>(tag_length));
+    for (size_t i = 0; i < tag_length; ++i) {
+      write_at(LENGTH_PREFIX_SIZE + length++, static_cast<uint8_t>(tag[i]));
+    }
+  }
+  filter_log_message(message, binary_prefix, [this, &length](char c) { write_at(LENGTH_PREFIX_SIZE + length++, static_cast<uint8_t>(c)); });
+
+  write_at(0, static_cast<uint8_t>(length));
+  write_at(1, static_cast<uint8_t>(length >> 8));
+  used += LENGTH_PREFIX_SIZE + length;
+  return true;
+}
+
+bool BLELogBuffer::peek_length(size_t& length) {
+  LockGuard guard(mutex);
+
+  if (used == 0) {
+    return false;
+  }
+  length = read_length_prefix();
+  return true;
+}
+
+bool BLELogBuffer::take(string& line) {
+  LockGuard guard(mutex);
+
+  if (used == 0) {
+    return false;
+  }
+
+  const size_t length = read_length_prefix();
+  uint8_t length_prefix[LENGTH_PREFIX_SIZE];
+  read(length_prefix, LENGTH_PREFIX_SIZE);
+
+  const size_t start = line.length();
+  line.resize(start + length);
+  read(reinterpret_cast<uint8_t*>(&line[start]), length);
+  return true;
+}
+
+uint32_t BLELogBuffer::get_dropped_count() {
+  LockGuard guard(mutex);
+  return dropped_count;
+}
+
+void BLELogBuffer::read(uint8_t* data, size_t length) {
+  const size_t first_part = std::min(length, buffer.size() - head);
+  memcpy(data, &buffer[head], first_part);
+  memcpy(data + first_part, &buffer[0], length - first_part);
+  head = (head + length) % buffer.size();
+  used -= length;
+}
+
+size_t BLELogBuffer::read_length_prefix() const {
+  return buffer[head] | (buffer[(head + 1) % buffer.size()] << 8);
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "esphome/core/helpers.h"
+
+using std::string;
+using std::vector;
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/**
+ * Fixed-size ring buffer for log lines, which decouples logging (possibly from other tasks) from sending the lines over BLE in the main loop.
+ * Lines are stored with a 2-byte length prefix. A line that does not fit into the free space is dropped (and counted), so adding never blocks for long and never allocates.
+ * Log messages are filtered while they are copied into the buffer, i.e. without intermediate copies.
+ * All methods are thread-safe.
+ * @brief Bounded buffer for log lines
+ */
+class BLELogBuffer {
+public:
+  /// Sets the capacity in bytes (only before the buffer is used).
+  void set_capacity(size_t capacity);
+
+  /**
+   * Adds a log message without the magic logger symbols (sequences that mark the start or the end, or a color).
+   * With binary prefix the line starts with the level (1 byte), the length of the tag (1 byte), and the tag, and the textual header of the message ("[D][tag:123]: ") is omitted.
+   * @return false if the message has been dropped because the buffer is full
+   */
+  bool add_log_message(const char* message, int level, const char* tag, bool binary_prefix);
+
+  /// @return true if there is a line, the length of the oldest line is returned via the parameter
+  bool peek_length(size_t& length);
+  /// Removes the oldest line and appends it to the given string, @return false if there is no line
+  bool take(string& line);
+
+  /// @return the total number of dropped lines
+  uint32_t get_dropped_count();
+
+private:
+  static const size_t LENGTH_PREFIX_SIZE = 2;
+
+  /// Writes a single byte at the given position (relative to the end of the used part) without marking it as used.
+  inline void write_at(size_t position, uint8_t data) { buffer[(head + used + position) % buffer.size()] = data; }
+  void read(uint8_t* data, size_t length);
+  size_t read_length_prefix() const;
+
+  Mutex mutex;
+  vector<uint8_t> buffer;
+  /// position of the oldest line
+  size_t head{0};
+  size_t used{0};
+  uint32_t dropped_count{0};
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
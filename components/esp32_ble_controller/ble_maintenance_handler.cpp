@@ -1,9 +1,12 @@
+#include <algorithm>
+
 #include <BLE2902.h>
 
 #include "ble_maintenance_handler.h"
 
 #include "esphome/core/log.h"
 #include "esphome/core/application.h"
+#include "esphome/core/hal.h"
 #ifdef USE_LOGGER
 #include "esphome/components/logger/logger.h"
 #endif
@@ -12,17 +15,30 @@
 #include "ble_command.h"
 #include "automation.h"
 #include "ble_utils.h"
+#include "ble_rpc_handler.h"
 
 // https://www.uuidgenerator.net
 #define SERVICE_UUID                "7b691dff-9062-4192-b46a-692e0da81d91"
 #define CHARACTERISTIC_UUID_CMD     "1d3c6498-cfdf-44a1-9038-3e757dcc449d"
 #define CHARACTERISTIC_UUID_LOGGING "a1083f3b-0ad6-49e0-8a9d-56eb5bf462ca"
+#define CHARACTERISTIC_UUID_DIAGNOSTICS "5f2b4a2e-8c1d-4f0a-9b57-3d6e2a91c7f4"
 
 namespace esphome {
 namespace esp32_ble_controller {
 
 static const char *TAG = "ble_maintenance_handler";
 
+/// maximum number of fragments of command results sent per loop iteration, so that the BLE stack is not flooded
+static const size_t MAX_COMMAND_RESULT_FRAGMENTS_PER_LOOP = 4;
+/// maximum number of notifications with log messages sent per loop iteration
+static const size_t MAX_LOG_NOTIFICATIONS_PER_LOOP = 4;
+/// service declaration and up to four characteristics, each with declaration, value, 0x2901 and 0x2902 descriptor
+static const uint32_t MAINTENANCE_SERVICE_HANDLES = 1 + 4 * 4;
+/// version of the format of the diagnostics characteristic
+static const uint8_t DIAGNOSTICS_FORMAT_VERSION = 1;
+/// interval in which the value of the diagnostics characteristic is rebuilt while a client is connected
+static const uint32_t DIAGNOSTICS_UPDATE_INTERVAL_MILLIS = 1000;
+
 BLEMaintenanceHandler::BLEMaintenanceHandler() : ble_command_characteristic(nullptr) {
   commands.push_back(new BLECommandHelp());
   commands.push_back(new BLECommandSwitchMaintenanceOnOrOff());
@@ -32,6 +48,10 @@ BLEMaintenanceHandler::BLEMaintenanceHandler() : ble_command_characteristic(null
 #endif
   commands.push_back(new BLECommandPairings());
   commands.push_back(new BLECommandVersion());
+  commands.push_back(new BLECommandLatency());
+  commands.push_back(new BLECommandConnectionProfile());
+  commands.push_back(new BLECommandConnections());
+  commands.push_back(new BLECommandStatistics());
 
 #ifdef USE_LOGGER
   log_level = ESPHOME_LOG_LEVEL;
@@ -44,22 +64,48 @@ BLEMaintenanceHandler::BLEMaintenanceHandler() : ble_command_characteristic(null
 void BLEMaintenanceHandler::setup(BLEServer* ble_server) {
   ESP_LOGCONFIG(TAG, "Setting up maintenance service");
 
-  BLEService* service = ble_server->createService(SERVICE_UUID);
+  BLEService* service = ble_server->createService(BLEUUID(SERVICE_UUID), MAINTENANCE_SERVICE_HANDLES);
+  maintenance_service = service;
 
-  ble_command_characteristic = create_writeable_ble_characteristic(service, CHARACTERISTIC_UUID_CMD, this, "BLE Command Channel");
+  // stable: of several commands with the same name the first registered one is found (as with a linear search)
+  commands_by_name = commands;
+  std::stable_sort(commands_by_name.begin(), commands_by_name.end(), [](const BLECommand* a, const BLECommand* b) { return a->get_name() < b->get_name(); });
+
+  const bool indicate = command_result_delivery == BLECommandResultDelivery::INDICATE;
+  ble_command_characteristic = create_writeable_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_CMD), this, "BLE Command Channel", true, indicate ? BLECharacteristic::PROPERTY_INDICATE : 0);
+  command_result_framer.set_use_indications(indicate);
   ble_command_characteristic->setValue("Send 'help' for help.");
  
 #ifdef USE_LOGGER
-  logging_characteristic = create_read_only_ble_characteristic(service, CHARACTERISTIC_UUID_LOGGING, "Log messages");
+  logging_characteristic = create_read_only_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_LOGGING), "Log messages");
 #endif
 
+  if (rpc_enabled) {
+    if (rpc_handler == nullptr) {
+      rpc_handler = new BLERPCHandler(this);
+    }
+    rpc_handler->setup(service);
+  }
+
+  if (diagnostics_enabled) {
+    diagnostics_characteristic = create_read_only_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_DIAGNOSTICS), "Diagnostics", false);
+  }
+
   service->start();
 
+  // the service may be added again at runtime (see ESP32BLEController::switch_ble_mode()), the rest is done once
+  if (set_up) {
+    return;
+  }
+  set_up = true;
+
 #ifdef USE_LOGGER
   if (!global_ble_controller->get_component_services_exposed()) {
     log_level = ESPHOME_LOG_LEVEL_CONFIG;
   }
 
+  log_buffer.set_capacity(log_buffer_size);
+
   // NOTE: We register the callback after the service has been started!
   if (logger::global_logger != nullptr) {
     logger::global_logger->add_on_log_callback([this](int level, const char *tag, const char *message) {
@@ -70,43 +116,238 @@ void BLEMaintenanceHandler::setup(BLEServer* ble_server) {
 #endif
 }
 
+void BLEMaintenanceHandler::remove_service() {
+  if (maintenance_service == nullptr) {
+    return;
+  }
+
+  ESP_LOGI(TAG, "Removing maintenance service");
+
+  global_ble_controller->remove_service(maintenance_service, MAINTENANCE_SERVICE_HANDLES);
+  maintenance_service = nullptr;
+
+  // nothing is sent to the characteristics of the removed service, setup() creates new ones
+  delete_ble_characteristic(ble_command_characteristic);
+  ble_command_characteristic = nullptr;
+  delete_ble_characteristic(diagnostics_characteristic);
+  diagnostics_characteristic = nullptr;
+#ifdef USE_LOGGER
+  delete_ble_characteristic(logging_characteristic);
+  logging_characteristic = nullptr;
+#endif
+  if (rpc_handler != nullptr) {
+    rpc_handler->delete_characteristic();
+  }
+}
+
+void BLEMaintenanceHandler::loop() {
+  if (command_result_framer.has_fragments()) {
+    command_result_framer.send_fragments(ble_command_characteristic, global_ble_controller->get_max_notification_size(), MAX_COMMAND_RESULT_FRAGMENTS_PER_LOOP);
+  }
+
+  if (rpc_handler != nullptr) {
+    rpc_handler->loop();
+  }
+
+  if (diagnostics_characteristic != nullptr && global_ble_controller->get_connection_count() > 0) {
+    const uint32_t now = millis();
+    if (now - diagnostics_update_millis >= DIAGNOSTICS_UPDATE_INTERVAL_MILLIS) {
+      diagnostics_update_millis = now;
+      update_diagnostics();
+    }
+  }
+
+#ifdef USE_LOGGER
+  flush_log_messages();
+#endif
+}
+
 void BLEMaintenanceHandler::onWrite(BLECharacteristic *characteristic) {
   if (characteristic == ble_command_characteristic) {
-    global_ble_controller->execute_in_loop([this](){ on_command_written(); });
+    // the timestamp travels with the deferred call, the loop owns the latency state (0 means "not measured")
+    const uint32_t received_micros = std::max<uint32_t>(micros(), 1);
+    global_ble_controller->execute_in_loop([this, received_micros](){ on_command_written(received_micros); }, this);
   } else {
     ESP_LOGW(TAG, "Unknown characteristic written!");
   }
 }
 
-void BLEMaintenanceHandler::on_command_written() {
-  string command_line = ble_command_characteristic->getValue();
+static void append_uint16(string& value, uint16_t number) {
+  value.push_back(static_cast<char>(number));
+  value.push_back(static_cast<char>(number >> 8));
+}
+
+static void append_uint32(string& value, uint32_t number) {
+  append_uint16(value, number);
+  append_uint16(value, number >> 16);
+}
+
+void BLEMaintenanceHandler::update_diagnostics() {
+  // built in the loop, which owns the statistics and the list of handlers; a read in the BLE task only gets the stored value
+  const BLETrafficStatistics& traffic = global_ble_controller->get_traffic_statistics();
+  const BLEHandlerStatistics total = global_ble_controller->get_handler_statistics_total();
+  const auto& queue = global_ble_controller->get_deferred_functions_queue();
+
+  string value;
+  value.push_back(static_cast<char>(DIAGNOSTICS_FORMAT_VERSION));
+  append_uint32(value, traffic.notifications);
+  append_uint32(value, traffic.bytes_sent);
+  append_uint32(value, total.writes_received);
+  append_uint32(value, total.values_suppressed);
+  append_uint16(value, queue.size());
+  append_uint16(value, queue.get_high_water_mark());
+  append_uint32(value, queue.get_dropped_count());
+  for (const uint32_t count : total.notify_latency.buckets) {
+    append_uint32(value, count);
+  }
+  diagnostics_characteristic->setValue(value);
+}
+
+void BLEMaintenanceHandler::on_command_written(uint32_t received_micros) {
+  if (ble_command_characteristic == nullptr) {
+    return; // the service has been removed in the meantime
+  }
+  command_received_micros = received_micros;
+  const string command_line = ble_command_characteristic->getValue();
   ESP_LOGD(TAG, "Received BLE command: %s", command_line.c_str());
-  vector<string> tokens = split(command_line);
-  if (!tokens.empty()) {
-    string command_name = tokens[0];
-    for (const auto& command : get_commands()) {
-      if (command->get_name() == command_name) {
-        ESP_LOGI(TAG, "Executing BLE command: %s", command_name.c_str());
-        tokens.erase(tokens.begin());
-        command->execute(tokens);
+
+  // tokenize in place: the name and the arguments refer to the command line
+  BLEStringRef command_name;
+  BLECommandArguments arguments;
+  const char* const end = command_line.data() + command_line.length();
+  for (const char* token = command_line.data(); token < end; ) {
+    const char* token_end = std::find(token, end, ' ');
+    if (token_end > token) {
+      const BLEStringRef token_ref(token, token_end - token);
+      if (command_name.empty()) {
+        command_name = token_ref;
+      } else if (!arguments.add(token_ref)) {
+        send_command_result("Too many arguments.");
         return;
       }
     }
-    send_command_result("Unkown command '" + command_name + "', try 'help'.");
+    token = token_end + 1;
+  }
+
+  if (!command_name.empty()) {
+    const BLECommand* command = find_command(command_name);
+    if (command != nullptr) {
+      ESP_LOGI(TAG, "Executing BLE command: %s", command->get_name().c_str());
+      command->execute(arguments);
+    } else {
+      send_command_result("Unkown command '" + command_name.str() + "', try 'help'.");
+    }
+  }
+}
+
+const BLECommand* BLEMaintenanceHandler::find_command(const BLEStringRef& name) const {
+  auto it = std::lower_bound(commands_by_name.begin(), commands_by_name.end(), name, [](const BLECommand* command, const BLEStringRef& name) { return name.compare(command->get_name()) > 0; });
+  if (it != commands_by_name.end() && name.compare((*it)->get_name()) == 0) {
+    return *it;
   }
+  return nullptr;
+}
+
+void BLEMaintenanceHandler::send_command_result(uint16_t invocation_id, const string& result_message) {
+  if (command_result_capture != nullptr) {
+    command_result_capture->push_back(result_message);
+    return;
+  }
+
+  if (ble_command_characteristic != nullptr) {
+    const string tagged_message = "#" + std::to_string(invocation_id) + " " + result_message;
+    deliver_command_result(tagged_message);
+  }
+}
+
+uint16_t BLEMaintenanceHandler::start_command_invocation(BLEControllerCustomCommandExecutionTrigger* trigger) {
+  expire_command_invocations();
+  if (running_invocations.size() >= max_running_commands) {
+    return 0;
+  }
+
+  if (++last_invocation_id == 0) { // 0 means "no invocation"
+    ++last_invocation_id;
+  }
+  running_invocations.push_back({ last_invocation_id, millis(), trigger });
+  return last_invocation_id;
+}
+
+void BLEMaintenanceHandler::expire_command_invocations() {
+  const uint32_t now = millis();
+  auto expired = [this, now](const BLECommandInvocation& invocation) {
+    // the completion action is skipped if the automation is stopped, so a trigger without running actions has no running invocations
+    if (!invocation.trigger->is_action_running()) {
+      ESP_LOGD(TAG, "Command invocation #%u has been stopped", invocation.id);
+      return true;
+    }
+    if (command_timeout_millis != 0 && now - invocation.start_millis >= command_timeout_millis) {
+      ESP_LOGW(TAG, "Command invocation #%u timed out", invocation.id);
+      return true;
+    }
+    return false;
+  };
+  running_invocations.erase(std::remove_if(running_invocations.begin(), running_invocations.end(), expired), running_invocations.end());
+}
+
+void BLEMaintenanceHandler::complete_command_invocation(uint16_t invocation_id) {
+  running_invocations.erase(std::remove_if(running_invocations.begin(), running_invocations.end(),
+    [invocation_id](const BLECommandInvocation& invocation) { return invocation.id == invocation_id; }), running_invocations.end());
+}
+
+bool BLEMaintenanceHandler::is_command_invocation_running(uint16_t invocation_id) const {
+  return std::any_of(running_invocations.begin(), running_invocations.end(),
+    [invocation_id](const BLECommandInvocation& invocation) { return invocation.id == invocation_id; });
 }
 
 void BLEMaintenanceHandler::send_command_result(const string& result_message) {
+  if (command_result_capture != nullptr) {
+    command_result_capture->push_back(result_message);
+    return;
+  }
+
   if (ble_command_characteristic != nullptr) {
-    global_ble_controller->execute_in_loop([this, result_message] { 
-      ble_command_characteristic->setValue(result_message);
-    });
+    deliver_command_result(result_message);
+  }
+}
+
+void BLEMaintenanceHandler::deliver_command_result(const string& result_message) {
+  if (!global_ble_controller->is_loop_task()) {
+    // the latency state belongs to the loop, results of other tasks are not measured
+    global_ble_controller->execute_in_loop([this, result_message] { publish_command_result(result_message, 0); });
+    return;
+  }
+
+  // already in the loop: published right away, so the result cannot be dropped by an overflow of the deferred functions queue
+  const uint32_t received_micros = command_received_micros;
+  command_received_micros = 0;
+  publish_command_result(result_message, received_micros);
+}
+
+void BLEMaintenanceHandler::publish_command_result(const string& result_message, uint32_t received_micros) {
+  if (ble_command_characteristic == nullptr) {
+    return; // the service has been removed since the result has been deferred
   }
 
-  // global_ble_controller->execute_in_loop([this, result_message] { 
-  //   const uint32_t delay_millis = 50;
-  //   App.scheduler.set_timeout(global_ble_controller, "command_result", delay_millis, [this, result_message]{ ble_command_characteristic->setValue(result_message); });
-  // });
+  if (framing_enabled) {
+    command_result_framer.add_message(result_message);
+  } else {
+    ble_command_characteristic->setValue(result_message);
+    if (command_result_delivery == BLECommandResultDelivery::NOTIFY) {
+      global_ble_controller->notify(ble_command_characteristic);
+    } else if (command_result_delivery == BLECommandResultDelivery::INDICATE) {
+      global_ble_controller->indicate(ble_command_characteristic);
+    }
+  }
+
+  if (received_micros != 0) {
+    const uint32_t latency = micros() - received_micros;
+    command_latency_statistics.last_us = latency;
+    command_latency_statistics.max_us = std::max(command_latency_statistics.max_us, latency);
+    command_latency_statistics.total_us += latency;
+    ++command_latency_statistics.count;
+    ESP_LOGV(TAG, "Command result published after %u us", latency);
+  }
 }
 
 bool BLEMaintenanceHandler::is_security_enabled() {
@@ -114,30 +355,59 @@ bool BLEMaintenanceHandler::is_security_enabled() {
 }
 
 #ifdef USE_LOGGER
-/**
- * Removes magic logger symbols from the message, e.g., sequences that mark the start or the end, or a color.
- */
-string remove_logger_magic(const string& message) {
-  // Note: We do not use regex replacement because it enlarges the binary by roughly 50kb!
-  string result;
-  bool within_magic = false;
-  for (string::size_type i = 0; i < message.length() - 1; ++i) {
-    if (message[i] == '\033' && message[i+1] == '[') { // log magic always starts with "\033[" see log.h
-      within_magic = true;
-      ++i;
-    } else if (within_magic) {
-      within_magic = (message[i] != 'm');
-    } else {
-      result.push_back(message[i]);
+void BLEMaintenanceHandler::send_log_message(int level, const char *tag, const char *message) {
+  if (logging_characteristic != nullptr && level <= this->log_level) {
+    log_buffer.add_log_message(message, level, tag, binary_log_prefix);
+  }
+}
+
+void BLEMaintenanceHandler::flush_log_messages() {
+  if (logging_characteristic == nullptr) {
+    return;
+  }
+
+  // pack as many lines as fit into a single notification (separated by newlines)
+  size_t max_size = global_ble_controller->get_max_notification_size();
+  if (framing_enabled) {
+    max_size -= BLE_FRAGMENT_HEADER_SIZE;
+  }
+
+  string messages;
+  const uint32_t dropped = log_buffer.get_dropped_count();
+  if (dropped != reported_dropped_log_messages) {
+    messages = "[" + to_string(dropped - reported_dropped_log_messages) + " log messages dropped]";
+    reported_dropped_log_messages = dropped;
+  }
+
+  size_t notifications = 0;
+  size_t length;
+  while (notifications < MAX_LOG_NOTIFICATIONS_PER_LOOP && log_buffer.peek_length(length)) {
+    if (!messages.empty() && messages.length() + 1 + length > max_size) {
+      send_log_messages(messages);
+      ++notifications;
+      messages.clear();
+      continue;
     }
+    if (!messages.empty()) {
+      messages += '\n';
+    }
+    log_buffer.take(messages);
+  }
+
+  if (!messages.empty()) {
+    send_log_messages(messages);
   }
-  return result;
 }
 
-void BLEMaintenanceHandler::send_log_message(int level, const char *tag, const char *message) {
-  if (logging_characteristic != nullptr && level <= this->log_level) {
-    logging_characteristic->setValue(remove_logger_magic(message));
-    logging_characteristic->notify();
+void BLEMaintenanceHandler::send_log_messages(const string& messages) {
+  if (framing_enabled) {
+    // lines that do not fit into a single notification are fragmented
+    log_message_framer.send_message(logging_characteristic, global_ble_controller->get_max_notification_size(), messages);
+  } else {
+    // lines that do not fit into a single notification are truncated
+    const size_t length = std::min(messages.length(), global_ble_controller->get_max_notification_size());
+    logging_characteristic->setValue(reinterpret_cast<uint8_t*>(const_cast<char*>(messages.data())), length);
+    global_ble_controller->notify(logging_characteristic);
   }
 }
 #endif
@@ -8,6 +8,9 @@
 
 #include "esphome/core/defines.h"
 
+#include "ble_log_buffer.h"
+#include "ble_message_framer.h"
+
 using std::string;
 using std::vector;
 
@@ -16,6 +19,28 @@ namespace esp32_ble_controller {
 
 class BLECommand;
 class BLEControllerCustomCommandExecutionTrigger;
+class BLEStringRef;
+class BLERPCHandler;
+
+/// How command results are delivered to the client.
+enum class BLECommandResultDelivery : uint8_t {
+  /// the result is only stored in the command characteristic, the client has to read it (legacy)
+  READ,
+  /// the result is stored and sent as notification
+  NOTIFY,
+  /// the result is stored and sent as indication (acknowledged by the client)
+  INDICATE,
+};
+
+/// Latency between receiving a command and handing its first result to the BLE stack.
+struct BLECommandLatencyStatistics {
+  uint32_t last_us{0};
+  uint32_t max_us{0};
+  uint32_t count{0};
+  uint64_t total_us{0};
+
+  uint32_t get_average_us() const { return count == 0 ? 0 : total_us / count; }
+};
 
 /**
  * Provides standard maintenance support for the BLE controller like logging over BLE and controlling BLE mode.
@@ -28,35 +53,130 @@ public:
   BLEMaintenanceHandler();
   virtual ~BLEMaintenanceHandler() {}
 
+  /// Adds the maintenance service to the given server (again after it has been removed).
   void setup(BLEServer* ble_server);
+  /// Removes the maintenance service from the server at runtime.
+  void remove_service();
+
+  void loop();
+
+  void set_framing_enabled(bool enabled) { framing_enabled = enabled; }
+  bool get_framing_enabled() const { return framing_enabled; }
+
+  /// Sets how command results are delivered (only before setup).
+  void set_command_result_delivery(BLECommandResultDelivery delivery) { command_result_delivery = delivery; }
+  const BLECommandLatencyStatistics& get_command_latency_statistics() const { return command_latency_statistics; }
+
+  /// Adds the binary RPC characteristic to the maintenance service (only before setup).
+  void set_rpc_enabled(bool enabled) { rpc_enabled = enabled; }
+  /// Adds the read-only binary diagnostics characteristic with the runtime statistics to the maintenance service (only before setup).
+  void set_diagnostics_enabled(bool enabled) { diagnostics_enabled = enabled; }
 
   void add_command(BLECommand* command) { commands.push_back(command); }
   const vector<BLECommand*>& get_commands() const { return commands; }
+  /// @return the command with the given name or nullptr (only after setup)
+  const BLECommand* find_command(const BLEStringRef& name) const;
   void send_command_result(const string& result_message);
+  /// Sends the result of an invocation of an asynchronous command as notification tagged with the invocation id ("#<id> <result>").
+  void send_command_result(uint16_t invocation_id, const string& result_message);
+  /// While set, command results are appended to the given vector instead of being sent (used by the RPC channel).
+  void set_command_result_capture(vector<string>* results) { command_result_capture = results; }
+
+  /// Sets the maximum number of invocations of asynchronous commands that may run at the same time.
+  void set_max_running_commands(size_t max_running) { max_running_commands = max_running; }
+  /// Sets the time after which a running invocation no longer counts against the maximum (0 = never).
+  void set_command_timeout(uint32_t timeout_millis) { command_timeout_millis = timeout_millis; }
+  /**
+   * Registers a new invocation of an asynchronous command executed by the given trigger, @return its id (never 0) or 0 if too many invocations are running.
+   * Invocations whose automation has been stopped (or has finished without completing them) or that have timed out are removed first.
+   */
+  uint16_t start_command_invocation(BLEControllerCustomCommandExecutionTrigger* trigger);
+  void complete_command_invocation(uint16_t invocation_id);
+  bool is_command_invocation_running(uint16_t invocation_id) const;
+  /// @return the id of the most recently started invocation
+  uint16_t get_last_command_invocation_id() const { return last_invocation_id; }
 
 #ifdef USE_LOGGER
   int get_log_level() { return log_level; }
   void set_log_level(int level) { log_level = level; }
 
+  /// Sets the size of the buffer for log messages (in bytes), only before setup.
+  void set_log_buffer_size(size_t size) { log_buffer_size = size; }
+  /// Sends level and tag of log messages as binary prefix instead of the textual header.
+  void set_binary_log_prefix(bool binary_prefix) { binary_log_prefix = binary_prefix; }
+
+  /// Buffers the log message, it is sent from the loop. (Can be called from any task.)
   void send_log_message(int level, const char *tag, const char *message);
 #endif
 
 private:
   virtual void onWrite(BLECharacteristic *characteristic) override;
-  void on_command_written();
+  /// Executes the written command in the loop, received_micros is the time when it has been written (taken in the BLE task).
+  void on_command_written(uint32_t received_micros);
+  /// Publishes a command result (deferred to the loop if called from another task), the first result of a command carries the receive time of the command.
+  void deliver_command_result(const string& result_message);
+  /// Publishes a command result (in the loop) and records the latency if received_micros is not 0, i.e. if the result is the first one of a command.
+  void publish_command_result(const string& result_message, uint32_t received_micros);
+  /// Rebuilds the value of the diagnostics characteristic from the current statistics (in the loop).
+  void update_diagnostics();
+
+#ifdef USE_LOGGER
+  void flush_log_messages();
+  void send_log_messages(const string& messages);
+#endif
 
   bool is_security_enabled();
   
 private:
-  BLEService* maintenance_service;
+  BLEService* maintenance_service{nullptr};
+  /// true once the parts of the setup that are independent of the service (like the log callback) are done
+  bool set_up{false};
 
   BLECharacteristic* ble_command_characteristic;
   vector<BLECommand*> commands;
+  /// the commands sorted by name for binary search, built at setup
+  vector<BLECommand*> commands_by_name;
+
+  bool framing_enabled{false};
+  BLECommandResultDelivery command_result_delivery{BLECommandResultDelivery::NOTIFY};
+
+  /// time when the last executed command has been received, in micro seconds, 0 once its first result has been published (only used in the loop)
+  uint32_t command_received_micros{0};
+  BLECommandLatencyStatistics command_latency_statistics;
+  /// fragments of command results, streamed from the loop
+  BLEMessageFramer command_result_framer;
+  vector<string>* command_result_capture{nullptr};
+
+  struct BLECommandInvocation {
+    uint16_t id;
+    uint32_t start_millis;
+    BLEControllerCustomCommandExecutionTrigger* trigger;
+  };
+  void expire_command_invocations();
+
+  size_t max_running_commands{4};
+  uint32_t command_timeout_millis{0};
+  /// invocations of asynchronous commands that are still running
+  vector<BLECommandInvocation> running_invocations;
+  uint16_t last_invocation_id{0};
+
+  bool rpc_enabled{false};
+  BLERPCHandler* rpc_handler{nullptr};
+
+  bool diagnostics_enabled{false};
+  BLECharacteristic* diagnostics_characteristic{nullptr};
+  uint32_t diagnostics_update_millis{0};
 
 #ifdef USE_LOGGER
   int log_level;
 
   BLECharacteristic* logging_characteristic;
+  BLEMessageFramer log_message_framer;
+
+  size_t log_buffer_size{1024};
+  bool binary_log_prefix{false};
+  BLELogBuffer log_buffer;
+  uint32_t reported_dropped_log_messages{0};
 #endif
 };
 
@@ -0,0 +1,76 @@
+#include "ble_message_framer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_gatt_defs.h>
+
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static const char *TAG = "ble_message_framer";
+
+bool BLEMessageFramer::add_message(const string& message) {
+  if (messages.size() >= BLE_FRAMER_MAX_QUEUED_MESSAGES) {
+    ++dropped_count;
+    ESP_LOGW(TAG, "Message queue full, dropped message (%u dropped in total)", dropped_count);
+    return false;
+  }
+  messages.push_back(message);
+  return true;
+}
+
+void BLEMessageFramer::send_fragments(BLECharacteristic* characteristic, size_t max_fragment_size, size_t max_fragments) {
+  uint8_t buffer[ESP_GATT_MAX_MTU_SIZE];
+  max_fragment_size = std::min(max_fragment_size, sizeof(buffer));
+
+  for (size_t fragments = 0; fragments < max_fragments && !messages.empty(); ++fragments) {
+    const size_t length = next_fragment(messages.front(), offset, buffer, max_fragment_size);
+    send_fragment(characteristic, buffer, length);
+
+    if (offset >= messages.front().length()) {
+      messages.pop_front();
+      offset = 0;
+    }
+  }
+}
+
+void BLEMessageFramer::send_message(BLECharacteristic* characteristic, size_t max_fragment_size, const string& message) {
+  uint8_t buffer[ESP_GATT_MAX_MTU_SIZE];
+  max_fragment_size = std::min(max_fragment_size, sizeof(buffer));
+
+  size_t message_offset = 0;
+  do {
+    const size_t length = next_fragment(message, message_offset, buffer, max_fragment_size);
+    send_fragment(characteristic, buffer, length);
+  } while (message_offset < message.length());
+}
+
+size_t BLEMessageFramer::next_fragment(const string& message, size_t& offset, uint8_t* buffer, size_t max_fragment_size) {
+  const size_t payload_size = std::min(message.length() - offset, max_fragment_size - BLE_FRAGMENT_HEADER_SIZE);
+
+  uint8_t flags = 0;
+  if (offset == 0) {
+    flags |= BLE_FRAGMENT_FLAG_FIRST;
+  }
+  if (offset + payload_size < message.length()) {
+    flags |= BLE_FRAGMENT_FLAG_MORE;
+  }
+
+  buffer[0] = sequence++;
+  buffer[1] = flags;
+  memcpy(buffer + BLE_FRAGMENT_HEADER_SIZE, message.data() + offset, payload_size);
+  offset += payload_size;
+
+  return BLE_FRAGMENT_HEADER_SIZE + payload_size;
+}
+
+void BLEMessageFramer::send_fragment(BLECharacteristic* characteristic, uint8_t* buffer, size_t length) {
+  characteristic->setValue(buffer, length);
+  send_fragment_to_clients(characteristic, use_indications);
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
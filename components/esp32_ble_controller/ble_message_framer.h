@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+#include <BLECharacteristic.h>
+
+using std::string;
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/// Size of the header of a fragment: sequence number and flags.
+static const size_t BLE_FRAGMENT_HEADER_SIZE = 2;
+/// Flag of a fragment: the fragment is the first one of a message.
+static const uint8_t BLE_FRAGMENT_FLAG_FIRST = 1 << 0;
+/// Flag of a fragment: more fragments of the same message follow (continuation).
+static const uint8_t BLE_FRAGMENT_FLAG_MORE = 1 << 1;
+
+/// Maximum number of queued messages, further messages are dropped until the client has drained the queue.
+static const size_t BLE_FRAMER_MAX_QUEUED_MESSAGES = 16;
+
+/**
+ * Sends the current value of the characteristic to the subscribed clients as indication or notification (see ESP32BLEController::indicate() and notify()).
+ * It is defined along with the controller, so that the framer does not depend on it (the host tests define their own).
+ */
+void send_fragment_to_clients(BLECharacteristic* characteristic, bool indication);
+
+/**
+ * Splits messages that may exceed the negotiated MTU into fragments that are sent as notifications of a characteristic.
+ * Each fragment starts with a header: a sequence number (incremented with every fragment, wrapping around, so that clients can detect lost fragments) and flags.
+ * A client reassembles a message by concatenating the payloads from a fragment with the FIRST flag up to the first fragment without the MORE flag.
+ * @brief Frames messages into MTU-sized fragments
+ */
+class BLEMessageFramer {
+public:
+  /**
+   * Queues a message, its fragments are sent by send_fragments().
+   * @return false if the message has been dropped because the queue is full
+   */
+  bool add_message(const string& message);
+  bool has_fragments() const { return !messages.empty(); }
+
+  /// @return the total number of dropped messages
+  uint32_t get_dropped_count() const { return dropped_count; }
+
+  /// Sends fragments as indications (acknowledged by the client) instead of notifications.
+  void set_use_indications(bool indications) { use_indications = indications; }
+
+  /**
+   * Sends the fragments of the queued messages as notifications of the given characteristic.
+   * @param max_fragment_size maximum size of a fragment including the header (the payload of a notification)
+   * @param max_fragments maximum number of fragments to send, the remaining fragments are sent by the next call
+   */
+  void send_fragments(BLECharacteristic* characteristic, size_t max_fragment_size, size_t max_fragments);
+
+  /// Sends the given message immediately as fragments (without queuing).
+  void send_message(BLECharacteristic* characteristic, size_t max_fragment_size, const string& message);
+
+private:
+  /// Writes the next fragment of the given message into the buffer, starting at offset (which is advanced).
+  size_t next_fragment(const string& message, size_t& offset, uint8_t* buffer, size_t max_fragment_size);
+  void send_fragment(BLECharacteristic* characteristic, uint8_t* buffer, size_t length);
+
+  std::deque<string> messages;
+  /// position in the first queued message
+  size_t offset{0};
+  uint8_t sequence{0};
+  uint32_t dropped_count{0};
+  bool use_indications{false};
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,241 @@
+#include "ble_rpc_handler.h"
+
+#include <algorithm>
+
+#include "esphome/core/application.h"
+#include "esphome/core/log.h"
+
+#include "esp32_ble_controller.h"
+#include "ble_maintenance_handler.h"
+#include "ble_utils.h"
+
+// https://www.uuidgenerator.net
+#define CHARACTERISTIC_UUID_RPC "eb2bbb7a-8062-4ae2-849e-c30e4f2eb3b8"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static const char *TAG = "ble_rpc_handler";
+
+/// size of the request header: opcode and request id
+static const size_t REQUEST_HEADER_SIZE = 3;
+/// maximum number of response fragments sent per loop iteration, so that the BLE stack is not flooded
+static const size_t MAX_RESPONSE_FRAGMENTS_PER_LOOP = 4;
+/// delay before rebooting (after clearing the WiFi configuration), so that the response can still be sent
+static const uint32_t REBOOT_DELAY_MILLIS = 1000;
+
+// request ///////////////////////////////////////////////////////////////////////////////////////////////
+
+bool BLERPCRequest::parse(const string& data) {
+  if (data.length() < REQUEST_HEADER_SIZE) {
+    return false;
+  }
+
+  opcode = static_cast<BLERPCOpcode>(data[0]);
+  request_id = static_cast<uint8_t>(data[1]) | (static_cast<uint8_t>(data[2]) << 8);
+
+  entry_count = 0;
+  for (size_t offset = REQUEST_HEADER_SIZE; offset < data.length(); ) {
+    if (entry_count == MAX_ENTRIES || offset + 2 > data.length()) {
+      return false;
+    }
+    const BLERPCType type = static_cast<BLERPCType>(data[offset]);
+    const size_t length = static_cast<uint8_t>(data[offset + 1]);
+    offset += 2;
+    if (offset + length > data.length()) {
+      return false;
+    }
+    entries[entry_count++] = { type, BLEStringRef(data.data() + offset, length) };
+    offset += length;
+  }
+  return true;
+}
+
+const BLEStringRef* BLERPCRequest::find(BLERPCType type, size_t n) const {
+  for (size_t i = 0; i < entry_count; ++i) {
+    if (entries[i].type == type && n-- == 0) {
+      return &entries[i].value;
+    }
+  }
+  return nullptr;
+}
+
+// handler ///////////////////////////////////////////////////////////////////////////////////////////////
+
+void BLERPCHandler::setup(BLEService* service) {
+  rpc_characteristic = create_writeable_ble_characteristic(service, BLEUUID(CHARACTERISTIC_UUID_RPC), this, "BLE RPC Channel");
+}
+
+void BLERPCHandler::delete_characteristic() {
+  delete_ble_characteristic(rpc_characteristic);
+  rpc_characteristic = nullptr;
+}
+
+void BLERPCHandler::loop() {
+  if (rpc_characteristic != nullptr && response_framer.has_fragments()) {
+    response_framer.send_fragments(rpc_characteristic, global_ble_controller->get_max_notification_size(), MAX_RESPONSE_FRAGMENTS_PER_LOOP);
+  }
+}
+
+void BLERPCHandler::onWrite(BLECharacteristic *characteristic) {
+  // every request is handled (no coalescing), so that requests can be pipelined
+  string data = characteristic->getValue();
+  global_ble_controller->execute_in_loop([this, data]() { handle_request(data); });
+}
+
+void BLERPCHandler::handle_request(const string& data) {
+  if (data.length() < REQUEST_HEADER_SIZE) {
+    ESP_LOGW(TAG, "Ignoring RPC request without header");
+    return;
+  }
+  BLERPCRequest request;
+  const bool valid = request.parse(data);
+
+  string response;
+  response.push_back(static_cast<char>(static_cast<uint8_t>(request.get_opcode()) | BLE_RPC_RESPONSE_FLAG));
+  response.push_back(static_cast<char>(request.get_request_id()));
+  response.push_back(static_cast<char>(request.get_request_id() >> 8));
+  response.push_back(0); // status
+
+  const BLERPCStatus status = valid ? execute(request, response) : BLERPCStatus::INVALID_ARGUMENTS;
+  response[REQUEST_HEADER_SIZE] = static_cast<char>(status);
+  ESP_LOGD(TAG, "RPC request %u (opcode 0x%02x) completed with status %u", request.get_request_id(), static_cast<uint8_t>(request.get_opcode()), static_cast<uint8_t>(status));
+
+  response_framer.add_message(response);
+}
+
+BLERPCStatus BLERPCHandler::execute(const BLERPCRequest& request, string& response) {
+  switch (request.get_opcode()) {
+    case BLERPCOpcode::VERSION: {
+      const string version = App.get_compilation_time();
+      add_entry(response, BLERPCType::TEXT, version.data(), version.length());
+      return BLERPCStatus::OK;
+    }
+
+    case BLERPCOpcode::PAIRINGS:
+      for (const auto& device : get_bonded_device_list()) {
+        add_entry(response, BLERPCType::BD_ADDRESS, reinterpret_cast<const char*>(device.bd_addr), sizeof(device.bd_addr));
+      }
+      return BLERPCStatus::OK;
+
+    case BLERPCOpcode::CLEAR_PAIRINGS:
+      remove_all_bonded_devices();
+      return BLERPCStatus::OK;
+
+    case BLERPCOpcode::LOG_LEVEL: {
+#ifdef USE_LOGGER
+      const BLEStringRef* level = request.find(BLERPCType::LEVEL);
+      if (level != nullptr) {
+        if (level->size() != 1) {
+          return BLERPCStatus::INVALID_ARGUMENTS;
+        }
+        global_ble_controller->set_log_level(static_cast<uint8_t>(level->get_data()[0]));
+      }
+      add_entry(response, BLERPCType::LEVEL, static_cast<uint8_t>(global_ble_controller->get_log_level()));
+      return BLERPCStatus::OK;
+#else
+      return BLERPCStatus::NOT_SUPPORTED;
+#endif
+    }
+
+    case BLERPCOpcode::BLE_SERVICES: {
+      const BLEStringRef* enabled = request.find(BLERPCType::ENABLED);
+      if (enabled != nullptr) {
+        if (enabled->size() != 1) {
+          return BLERPCStatus::INVALID_ARGUMENTS;
+        }
+        // like the ble-services command: the controller applies the switch shortly after the response has been sent
+        global_ble_controller->switch_component_services_exposed(enabled->get_data()[0] != 0);
+      }
+      add_entry(response, BLERPCType::ENABLED, global_ble_controller->get_requested_component_services_exposed());
+      return BLERPCStatus::OK;
+    }
+
+    case BLERPCOpcode::WIFI_CONFIG: {
+#ifdef USE_WIFI
+      const BLEStringRef* ssid = request.find(BLERPCType::SSID);
+      const BLEStringRef* password = request.find(BLERPCType::PASSWORD);
+      const BLEStringRef* hidden = request.find(BLERPCType::HIDDEN);
+      if (request.find(BLERPCType::CLEAR) != nullptr) {
+        App.scheduler.set_timeout(global_ble_controller, "rpc-wifi-config", REBOOT_DELAY_MILLIS, []() { global_ble_controller->clear_wifi_configuration_and_reboot(); });
+        return BLERPCStatus::OK;
+      } else if (ssid != nullptr && password != nullptr) {
+        const bool hidden_network = hidden != nullptr && hidden->size() == 1 && hidden->get_data()[0] != 0;
+        global_ble_controller->set_wifi_configuration(ssid->str(), password->str(), hidden_network);
+      } else if (ssid != nullptr || password != nullptr) {
+        return BLERPCStatus::INVALID_ARGUMENTS;
+      }
+
+      auto current_ssid = global_ble_controller->get_current_ssid_in_wifi_configuration();
+      if (current_ssid.has_value()) {
+        add_entry(response, BLERPCType::SSID, current_ssid.value().data(), current_ssid.value().length());
+      }
+      return BLERPCStatus::OK;
+#else
+      return BLERPCStatus::NOT_SUPPORTED;
+#endif
+    }
+
+    case BLERPCOpcode::EXECUTE_COMMAND: {
+      const BLEStringRef* command_name = request.find(BLERPCType::COMMAND);
+      if (command_name == nullptr) {
+        return BLERPCStatus::INVALID_ARGUMENTS;
+      }
+      const BLECommand* command = global_ble_controller->find_command(*command_name);
+      if (command == nullptr) {
+        return BLERPCStatus::UNKNOWN_COMMAND;
+      }
+
+      BLECommandArguments arguments;
+      for (size_t i = 0; const BLEStringRef* argument = request.find(BLERPCType::ARGUMENT, i); ++i) {
+        if (!arguments.add(*argument)) {
+          return BLERPCStatus::INVALID_ARGUMENTS;
+        }
+      }
+
+      // results sent while the command executes become part of the response
+      vector<string> results;
+      const uint16_t previous_invocation_id = maintenance_handler->get_last_command_invocation_id();
+      maintenance_handler->set_command_result_capture(&results);
+      command->execute(arguments);
+      maintenance_handler->set_command_result_capture(nullptr);
+
+      for (const auto& result : results) {
+        add_entry(response, BLERPCType::TEXT, result.data(), result.length());
+      }
+
+      // later results of an asynchronous custom command are sent on the command characteristic, tagged with the invocation id
+      const uint16_t invocation_id = maintenance_handler->get_last_command_invocation_id();
+      if (invocation_id != previous_invocation_id && maintenance_handler->is_command_invocation_running(invocation_id)) {
+        const char id[] = { static_cast<char>(invocation_id), static_cast<char>(invocation_id >> 8) };
+        add_entry(response, BLERPCType::INVOCATION_ID, id, sizeof(id));
+      }
+      return BLERPCStatus::OK;
+    }
+
+    default:
+      return BLERPCStatus::UNKNOWN_OPCODE;
+  }
+}
+
+void BLERPCHandler::add_entry(string& response, BLERPCType type, const char* value, size_t length) {
+  // the length of an entry is a single byte, longer values are split into CONTINUED entries followed by the last part
+  while (length > UINT8_MAX) {
+    response.push_back(static_cast<char>(BLERPCType::CONTINUED));
+    response.push_back(static_cast<char>(UINT8_MAX));
+    response.append(value, UINT8_MAX);
+    value += UINT8_MAX;
+    length -= UINT8_MAX;
+  }
+  response.push_back(static_cast<char>(type));
+  response.push_back(static_cast<char>(length));
+  response.append(value, length);
+}
+
+void BLERPCHandler::add_entry(string& response, BLERPCType type, uint8_t value) {
+  const char data = static_cast<char>(value);
+  add_entry(response, type, &data, 1);
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
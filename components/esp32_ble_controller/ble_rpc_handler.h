@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <BLEServer.h>
+#include <BLECharacteristic.h>
+
+#include "esphome/core/defines.h"
+
+#include "ble_command.h"
+#include "ble_message_framer.h"
+
+using std::string;
+using std::vector;
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+class BLEMaintenanceHandler;
+
+/// Operation requested by a binary RPC request.
+enum class BLERPCOpcode : uint8_t {
+  /// response: TEXT with the version
+  VERSION = 0x01,
+  /// response: one BD_ADDRESS per paired device
+  PAIRINGS = 0x02,
+  CLEAR_PAIRINGS = 0x03,
+  /// optional argument: LEVEL to set, response: LEVEL
+  LOG_LEVEL = 0x04,
+  /// optional argument: ENABLED to switch the component services on or off (at runtime, without reboot), response: ENABLED as requested (the services are added or removed shortly after the response)
+  BLE_SERVICES = 0x05,
+  /// arguments: SSID, PASSWORD, and optional HIDDEN to set the configuration, or CLEAR to clear it (reboots), response: SSID (if configured)
+  WIFI_CONFIG = 0x06,
+  /// arguments: COMMAND and any number of ARGUMENT, response: TEXT for every result sent by the command while executing, and INVOCATION_ID if the custom command continues to run asynchronously
+  EXECUTE_COMMAND = 0x07,
+};
+
+/// Status of a binary RPC response.
+enum class BLERPCStatus : uint8_t { OK = 0, UNKNOWN_OPCODE = 1, INVALID_ARGUMENTS = 2, UNKNOWN_COMMAND = 3, NOT_SUPPORTED = 4 };
+
+/// Type of a type-length-value entry in binary RPC requests and responses.
+enum class BLERPCType : uint8_t {
+  TEXT = 0x01,
+  LEVEL = 0x02,
+  ENABLED = 0x03,
+  BD_ADDRESS = 0x04,
+  SSID = 0x05,
+  PASSWORD = 0x06,
+  HIDDEN = 0x07,
+  CLEAR = 0x08,
+  COMMAND = 0x09,
+  ARGUMENT = 0x0A,
+  INVOCATION_ID = 0x0B,
+  /// part of a value longer than 255 bytes, the value continues with the next entry (the last part has the type of the value)
+  CONTINUED = 0x0C,
+};
+
+/// The opcode of a response is the opcode of the request with this flag.
+static const uint8_t BLE_RPC_RESPONSE_FLAG = 0x80;
+
+/// A parsed request: header (opcode, request id) and type-length-value entries referring to the received data.
+class BLERPCRequest {
+public:
+  static const size_t MAX_ENTRIES = 16;
+
+  /// @return false if the data is not a well-formed request
+  bool parse(const string& data);
+
+  BLERPCOpcode get_opcode() const { return opcode; }
+  uint16_t get_request_id() const { return request_id; }
+
+  /// @return the value of the n-th entry of the given type or nullptr
+  const BLEStringRef* find(BLERPCType type, size_t n = 0) const;
+
+private:
+  struct Entry {
+    BLERPCType type;
+    BLEStringRef value;
+  };
+
+  BLERPCOpcode opcode;
+  uint16_t request_id{0};
+  Entry entries[MAX_ENTRIES];
+  size_t entry_count{0};
+};
+
+/**
+ * Provides a binary request/response protocol on its own characteristic of the maintenance service, as an alternative to the text command channel for tools.
+ * A request consists of the opcode (1 byte), the request id (2 bytes, little endian), and type-length-value entries (1 byte type, 1 byte length, value).
+ * A response consists of the opcode with BLE_RPC_RESPONSE_FLAG, the request id, the status (1 byte), and type-length-value entries.
+ * Responses are sent as notifications framed by BLEMessageFramer, in the order of the requests, so clients can send several requests without waiting and match the responses by request id.
+ * @brief Binary RPC channel of the maintenance service
+ */
+class BLERPCHandler : private BLECharacteristicCallbacks {
+public:
+  BLERPCHandler(BLEMaintenanceHandler* maintenance_handler) : maintenance_handler(maintenance_handler) {}
+  virtual ~BLERPCHandler() {}
+
+  void setup(BLEService* service);
+  /// Deletes the characteristic after the maintenance service has been removed.
+  void delete_characteristic();
+  void loop();
+
+private:
+  virtual void onWrite(BLECharacteristic *characteristic) override;
+
+  void handle_request(const string& data);
+  BLERPCStatus execute(const BLERPCRequest& request, string& response);
+
+  static void add_entry(string& response, BLERPCType type, const char* value, size_t length);
+  static void add_entry(string& response, BLERPCType type, uint8_t value);
+
+  BLEMaintenanceHandler* maintenance_handler;
+
+  BLECharacteristic* rpc_characteristic{nullptr};
+  BLEMessageFramer response_framer;
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
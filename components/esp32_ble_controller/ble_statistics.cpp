@@ -0,0 +1,45 @@
+#include "ble_statistics.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/// each bucket covers four times the range of the previous one
+static const uint32_t BUCKET_FACTOR = 4;
+
+void BLELatencyHistogram::record(uint32_t latency_us) {
+  size_t bucket = 0;
+  for (uint32_t bound_us = 1000; bucket < BUCKET_COUNT - 1 && latency_us >= bound_us; bound_us *= BUCKET_FACTOR) {
+    ++bucket;
+  }
+  ++buckets[bucket];
+}
+
+uint32_t BLELatencyHistogram::get_upper_bound_ms(size_t bucket) {
+  if (bucket >= BUCKET_COUNT - 1) {
+    return 0;
+  }
+  uint32_t bound_ms = 1;
+  for (size_t i = 0; i < bucket; ++i) {
+    bound_ms *= BUCKET_FACTOR;
+  }
+  return bound_ms;
+}
+
+BLELatencyHistogram& BLELatencyHistogram::operator+=(const BLELatencyHistogram& other) {
+  for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+    buckets[i] += other.buckets[i];
+  }
+  return *this;
+}
+
+BLEHandlerStatistics& BLEHandlerStatistics::operator+=(const BLEHandlerStatistics& other) {
+  traffic.notifications += other.traffic.notifications;
+  traffic.bytes_sent += other.traffic.bytes_sent;
+  writes_received += other.writes_received;
+  values_suppressed += other.values_suppressed;
+  notify_latency += other.notify_latency;
+  return *this;
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
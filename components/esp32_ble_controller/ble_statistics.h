@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/**
+ * Histogram of latencies with logarithmic buckets: below 1ms, 4ms, 16ms, 64ms, 256ms, 1s, 4s, and above.
+ * Recording is a few comparisons and an increment, so it can stay on in production.
+ */
+struct BLELatencyHistogram {
+  static const size_t BUCKET_COUNT = 8;
+
+  uint32_t buckets[BUCKET_COUNT]{};
+
+  void record(uint32_t latency_us);
+  /// @return the exclusive upper bound of the given bucket in milliseconds (0 for the last bucket, which is unbounded)
+  static uint32_t get_upper_bound_ms(size_t bucket);
+
+  BLELatencyHistogram& operator+=(const BLELatencyHistogram& other);
+};
+
+/// Notifications sent (one per client) and their payload.
+struct BLETrafficStatistics {
+  uint32_t notifications{0};
+  uint32_t bytes_sent{0};
+};
+
+/// Counters of a component handler.
+struct BLEHandlerStatistics {
+  BLETrafficStatistics traffic;
+  /// number of values written by clients
+  uint32_t writes_received{0};
+  /// number of state changes that have not been notified (nobody listening, deadband, or replaced by a newer value within the notify interval)
+  uint32_t values_suppressed{0};
+  /// time between a state change and the notification of the new value
+  BLELatencyHistogram notify_latency;
+
+  BLEHandlerStatistics& operator+=(const BLEHandlerStatistics& other);
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,38 @@
+#include "ble_statistics_sensors.h"
+
+#ifdef USE_SENSOR
+#include "esp32_ble_controller.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+static void publish(sensor::Sensor* sensor, uint32_t value) {
+  if (sensor != nullptr) {
+    sensor->publish_state(value);
+  }
+}
+
+void BLEStatisticsSensors::update() {
+  if (global_ble_controller == nullptr) {
+    return; // BLE inactive
+  }
+
+  const BLETrafficStatistics& traffic = global_ble_controller->get_traffic_statistics();
+  publish(notifications_sensor, traffic.notifications);
+  publish(bytes_sent_sensor, traffic.bytes_sent);
+
+  if (writes_received_sensor != nullptr || values_suppressed_sensor != nullptr) {
+    const BLEHandlerStatistics total = global_ble_controller->get_handler_statistics_total();
+    publish(writes_received_sensor, total.writes_received);
+    publish(values_suppressed_sensor, total.values_suppressed);
+  }
+
+  const auto& queue = global_ble_controller->get_deferred_functions_queue();
+  publish(queue_high_water_sensor, queue.get_high_water_mark());
+  publish(queue_dropped_sensor, queue.get_dropped_count());
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
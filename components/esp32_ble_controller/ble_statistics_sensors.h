@@ -0,0 +1,41 @@
+#pragma once
+
+#include "esphome/core/component.h"
+#include "esphome/core/defines.h"
+
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/**
+ * Publishes the runtime statistics of the BLE controller (see the 'stats' command) as ESPHome sensors.
+ * @brief Sensors for the BLE controller statistics
+ */
+class BLEStatisticsSensors : public PollingComponent {
+public:
+  void set_notifications_sensor(sensor::Sensor* sensor) { notifications_sensor = sensor; }
+  void set_bytes_sent_sensor(sensor::Sensor* sensor) { bytes_sent_sensor = sensor; }
+  void set_writes_received_sensor(sensor::Sensor* sensor) { writes_received_sensor = sensor; }
+  void set_values_suppressed_sensor(sensor::Sensor* sensor) { values_suppressed_sensor = sensor; }
+  void set_queue_high_water_sensor(sensor::Sensor* sensor) { queue_high_water_sensor = sensor; }
+  void set_queue_dropped_sensor(sensor::Sensor* sensor) { queue_dropped_sensor = sensor; }
+
+  void update() override;
+
+  float get_setup_priority() const override { return setup_priority::DATA; }
+
+private:
+  sensor::Sensor* notifications_sensor{nullptr};
+  sensor::Sensor* bytes_sent_sensor{nullptr};
+  sensor::Sensor* writes_received_sensor{nullptr};
+  sensor::Sensor* values_suppressed_sensor{nullptr};
+  sensor::Sensor* queue_high_water_sensor{nullptr};
+  sensor::Sensor* queue_dropped_sensor{nullptr};
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+#endif
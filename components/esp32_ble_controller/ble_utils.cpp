@@ -1,36 +1,50 @@
 #include "ble_utils.h"
 
+#include <cstring>
+
 #include <BLE2902.h>
+#include <BLE2904.h>
 
 #include "esphome/core/log.h"
 
 #include "esp32_ble_controller.h"
+#include "ble_component_handler_base.h"
+#include "ble_value_encoding.h"
 
 namespace esphome {
 namespace esp32_ble_controller {
 
 static const char *TAG = "ble_utils";
 
-vector<string> get_bonded_devices() {
-  vector<string> paired_devices;
-
+vector<esp_ble_bond_dev_t> get_bonded_device_list() {
   int dev_num = esp_ble_get_bond_device_num();
+  if (dev_num <= 0) {
+    return {};
+  }
 
-  esp_ble_bond_dev_t *dev_list = (esp_ble_bond_dev_t*) malloc(sizeof(esp_ble_bond_dev_t) * dev_num);
-  esp_ble_get_bond_device_list(&dev_num, dev_list);
+  vector<esp_ble_bond_dev_t> dev_list(dev_num);
+  esp_ble_get_bond_device_list(&dev_num, dev_list.data());
+  dev_list.resize(dev_num);
 
-  for (int i = 0; i < dev_num; i++) {
-    char bd_address_str[18];
-    esp_bd_addr_t& bd_address = dev_list[i].bd_addr;
-    snprintf(bd_address_str, sizeof(bd_address_str), "%X:%X:%X:%X:%X:%X", bd_address[0], bd_address[1], bd_address[2], bd_address[3], bd_address[4], bd_address[5]);
-    paired_devices.push_back(bd_address_str);
-  }
+  return dev_list;
+}
 
-  free(dev_list);
+vector<string> get_bonded_devices() {
+  vector<string> paired_devices;
+
+  for (const auto& device : get_bonded_device_list()) {
+    paired_devices.push_back(bd_address_to_string(device.bd_addr));
+  }
 
   return paired_devices;
 }
 
+string bd_address_to_string(const esp_bd_addr_t bd_address) {
+  char bd_address_str[18];
+  snprintf(bd_address_str, sizeof(bd_address_str), "%X:%X:%X:%X:%X:%X", bd_address[0], bd_address[1], bd_address[2], bd_address[3], bd_address[4], bd_address[5]);
+  return bd_address_str;
+}
+
 void remove_all_bonded_devices()
 {
   int dev_num = esp_ble_get_bond_device_num();
@@ -42,18 +56,22 @@ void remove_all_bonded_devices()
   }
 
   free(dev_list);
+  global_ble_controller->clear_bonded_subscriptions();
 }
 
-BLECharacteristic* create_ble_characteristic(BLEService* service, const string& characteristic_uuid, uint32_t properties, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902) {
-  BLECharacteristic* characteristic = service->createCharacteristic(characteristic_uuid, properties);
-
-  // Set access permissions.
-  esp_gatt_perm_t access_permissions;
+static esp_gatt_perm_t get_access_permissions() {
   if (global_ble_controller->get_security_enabled()) {
-    access_permissions = ESP_GATT_PERM_READ_ENC_MITM | ESP_GATT_PERM_WRITE_ENC_MITM; // signing (ESP_GATT_PERM_WRITE_SIGNED_MITM) did not work with iPhone
+    return ESP_GATT_PERM_READ_ENC_MITM | ESP_GATT_PERM_WRITE_ENC_MITM; // signing (ESP_GATT_PERM_WRITE_SIGNED_MITM) did not work with iPhone
   } else {
-    access_permissions = ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE;
+    return ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE;
   }
+}
+
+BLECharacteristic* create_ble_characteristic(BLEService* service, const BLEUUID& characteristic_uuid, uint32_t properties, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902) {
+  BLECharacteristic* characteristic = service->createCharacteristic(characteristic_uuid, properties);
+
+  // Set access permissions.
+  const esp_gatt_perm_t access_permissions = get_access_permissions();
   characteristic->setAccessPermissions(access_permissions);
 
   // Add a 2901 descriptor to the characteristic, which sets a user-friendly description.
@@ -64,7 +82,7 @@ BLECharacteristic* create_ble_characteristic(BLEService* service, const string&
 
   // If requested, add a 2902 descriptor to the characteristic, which lets the client control if it wants to receive new values (and notifications) for this characteristic.
   if (with2902) {
-    // With this descriptor clients can switch notifications on and off, but we want to send notifications anyway as long as we are connected. The homebridge plug-in cannot turn notifications on and off.
+    // With this descriptor clients switch notifications on and off. Notifications are only sent to clients that switched them on, unless a characteristic is configured with 'notify_unsubscribed' (the homebridge plug-in cannot turn notifications on and off).
     // https://www.bluetooth.com/specifications/gatt/viewer?attributeXmlFile=org.bluetooth.descriptor.gatt.client_characteristic_configuration.xml
     BLEDescriptor* descriptor_2902 = new BLE2902();
     descriptor_2902->setAccessPermissions(access_permissions);
@@ -78,16 +96,53 @@ BLECharacteristic* create_ble_characteristic(BLEService* service, const string&
   return characteristic;
 }
 
-BLECharacteristic* create_read_only_ble_characteristic(BLEService* service, const string& characteristic_uuid, const string& description, bool with2902) {
+BLECharacteristic* create_read_only_ble_characteristic(BLEService* service, const BLEUUID& characteristic_uuid, const string& description, bool with2902, BLECharacteristicCallbacks* callbacks) {
   uint32_t properties = BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY;
-  return create_ble_characteristic(service, characteristic_uuid, properties, nullptr, description, with2902);
+  return create_ble_characteristic(service, characteristic_uuid, properties, callbacks, description, with2902);
 }
 
-BLECharacteristic* create_writeable_ble_characteristic(BLEService* service, const string& characteristic_uuid, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902) {
-  uint32_t properties = BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY | BLECharacteristic::PROPERTY_WRITE;
+BLECharacteristic* create_writeable_ble_characteristic(BLEService* service, const BLEUUID& characteristic_uuid, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902, uint32_t additional_properties) {
+  uint32_t properties = BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY | BLECharacteristic::PROPERTY_WRITE | additional_properties;
   return create_ble_characteristic(service, characteristic_uuid, properties, callbacks, description, with2902);
 }
 
+void delete_ble_characteristic(BLECharacteristic* characteristic) {
+  if (characteristic == nullptr) {
+    return;
+  }
+  // the characteristic does not own its descriptors, these are the ones added above
+  for (const uint16_t descriptor_uuid : { 0x2901, 0x2902, 0x2904 }) {
+    delete characteristic->getDescriptorByUUID(BLEUUID(descriptor_uuid));
+  }
+  delete characteristic;
+}
+
+void add_presentation_format_descriptor(BLECharacteristic* characteristic, const BLEPresentationFormat& format) {
+  // https://www.bluetooth.com/specifications/specs/core-specification/ (Vol 3, Part G, 3.3.3.5 Characteristic Presentation Format)
+  BLE2904* descriptor_2904 = new BLE2904();
+  descriptor_2904->setAccessPermissions(get_access_permissions());
+  descriptor_2904->setFormat(format.format);
+  descriptor_2904->setExponent(format.exponent);
+  descriptor_2904->setUnit(format.unit);
+  descriptor_2904->setNamespace(1); // Bluetooth SIG
+  descriptor_2904->setDescription(0);
+  characteristic->addDescriptor(descriptor_2904);
+}
+
+BLEUUID to_ble_uuid(const BLEUUIDBytes& uuid) {
+  const uint8_t* bytes = uuid.bytes;
+  switch (uuid.length) {
+    case 2:
+      return BLEUUID(static_cast<uint16_t>(bytes[0] << 8 | bytes[1]));
+    case 4:
+      return BLEUUID(static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 | static_cast<uint32_t>(bytes[2]) << 8 | bytes[3]);
+    default:
+      uint8_t msb_first[16];
+      memcpy(msb_first, bytes, sizeof(msb_first));
+      return BLEUUID(msb_first, sizeof(msb_first), true);
+  }
+}
+
 vector<string> split(string text, char delimiter) {
   vector<string> result;
   int j = 0;
@@ -4,6 +4,8 @@
 #include <vector>
 
 #include <BLECharacteristic.h>
+#include <BLEUUID.h>
+#include <esp_gap_ble_api.h>
 
 using std::string;
 using std::vector;
@@ -11,12 +13,26 @@ using std::vector;
 namespace esphome {
 namespace esp32_ble_controller {
 
+struct BLEPresentationFormat;
+struct BLEUUIDBytes;
+
+vector<esp_ble_bond_dev_t> get_bonded_device_list();
 vector<string> get_bonded_devices();
 void remove_all_bonded_devices();
+string bd_address_to_string(const esp_bd_addr_t bd_address);
+
+BLECharacteristic* create_read_only_ble_characteristic(BLEService* service, const BLEUUID& characteristic_uuid, const string& description, bool with2902 = true, BLECharacteristicCallbacks* callbacks = nullptr);
+
+/// @param additional_properties properties in addition to read, write, and notify (like indicate)
+BLECharacteristic* create_writeable_ble_characteristic(BLEService* service, const BLEUUID& characteristic_uuid, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902 = true, uint32_t additional_properties = 0);
+
+/// Deletes a characteristic created by the functions above incl. its descriptors, once its service has been removed from the GATT server.
+void delete_ble_characteristic(BLECharacteristic* characteristic);
 
-BLECharacteristic* create_read_only_ble_characteristic(BLEService* service, const string& characteristic_uuid, const string& description, bool with2902 = true);
+/// Adds a characteristic presentation format descriptor (0x2904) to the given characteristic.
+void add_presentation_format_descriptor(BLECharacteristic* characteristic, const BLEPresentationFormat& format);
 
-BLECharacteristic* create_writeable_ble_characteristic(BLEService* service, const string& characteristic_uuid, BLECharacteristicCallbacks* callbacks, const string& description, bool with2902 = true);
+BLEUUID to_ble_uuid(const BLEUUIDBytes& uuid);
 
 vector<string> split(string text, char delimiter = ' ');
 
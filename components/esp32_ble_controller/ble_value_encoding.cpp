@@ -0,0 +1,95 @@
+#include "ble_value_encoding.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+template <typename I>
+static size_t encode_scaled_integer(float value, int8_t exponent, uint8_t* buffer) {
+  I raw;
+  if (std::isnan(value)) {
+    raw = std::numeric_limits<I>::is_signed ? std::numeric_limits<I>::min() : std::numeric_limits<I>::max();
+  } else {
+    // the minimum (signed) or maximum (unsigned) value is reserved for "value unknown"
+    const double min = std::numeric_limits<I>::is_signed ? static_cast<double>(std::numeric_limits<I>::min()) + 1 : 0;
+    const double max = std::numeric_limits<I>::is_signed ? std::numeric_limits<I>::max() : static_cast<double>(std::numeric_limits<I>::max()) - 1;
+    double scaled = std::round(value / std::pow(10.0, exponent));
+    raw = static_cast<I>(std::min(max, std::max(min, scaled)));
+  }
+
+  // little endian
+  for (size_t i = 0; i < sizeof(I); ++i) {
+    buffer[i] = static_cast<uint8_t>(static_cast<typename std::make_unsigned<I>::type>(raw) >> (8 * i));
+  }
+  return sizeof(I);
+}
+
+int8_t get_effective_exponent(BLEValueEncoding encoding, int8_t exponent) {
+  switch (encoding) {
+    case BLEValueEncoding::TEMPERATURE:
+    case BLEValueEncoding::HUMIDITY:
+      return -2;
+    case BLEValueEncoding::PRESSURE:
+      return -1;
+    case BLEValueEncoding::SINT16:
+    case BLEValueEncoding::UINT16:
+    case BLEValueEncoding::SINT32:
+    case BLEValueEncoding::UINT32:
+      return exponent;
+    default:
+      return 0;
+  }
+}
+
+size_t encode_float_value(float value, BLEValueEncoding encoding, int8_t exponent, uint8_t* buffer) {
+  exponent = get_effective_exponent(encoding, exponent);
+  switch (encoding) {
+    case BLEValueEncoding::SINT16:
+    case BLEValueEncoding::TEMPERATURE:
+      return encode_scaled_integer<int16_t>(value, exponent, buffer);
+    case BLEValueEncoding::UINT16:
+    case BLEValueEncoding::HUMIDITY:
+      return encode_scaled_integer<uint16_t>(value, exponent, buffer);
+    case BLEValueEncoding::SINT32:
+      return encode_scaled_integer<int32_t>(value, exponent, buffer);
+    case BLEValueEncoding::UINT32:
+    case BLEValueEncoding::PRESSURE:
+      return encode_scaled_integer<uint32_t>(value, exponent, buffer);
+    default:
+      // the ESP32 is little endian
+      memcpy(buffer, &value, sizeof(value));
+      return sizeof(value);
+  }
+}
+
+BLEPresentationFormat get_presentation_format(BLEValueEncoding encoding, int8_t exponent) {
+  exponent = get_effective_exponent(encoding, exponent);
+  switch (encoding) {
+    case BLEValueEncoding::SINT16:
+      return {BLE_FORMAT_SINT16, exponent, BLE_UNIT_UNITLESS};
+    case BLEValueEncoding::UINT16:
+      return {BLE_FORMAT_UINT16, exponent, BLE_UNIT_UNITLESS};
+    case BLEValueEncoding::SINT32:
+      return {BLE_FORMAT_SINT32, exponent, BLE_UNIT_UNITLESS};
+    case BLEValueEncoding::UINT32:
+      return {BLE_FORMAT_UINT32, exponent, BLE_UNIT_UNITLESS};
+    case BLEValueEncoding::TEMPERATURE:
+      return {BLE_FORMAT_SINT16, exponent, BLE_UNIT_CELSIUS};
+    case BLEValueEncoding::HUMIDITY:
+      return {BLE_FORMAT_UINT16, exponent, BLE_UNIT_PERCENTAGE};
+    case BLEValueEncoding::PRESSURE:
+      return {BLE_FORMAT_UINT32, exponent, BLE_UNIT_PASCAL};
+    case BLEValueEncoding::PACKED:
+      return {BLE_FORMAT_STRUCT, 0, BLE_UNIT_UNITLESS};
+    default:
+      return {BLE_FORMAT_FLOAT32, 0, BLE_UNIT_UNITLESS};
+  }
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
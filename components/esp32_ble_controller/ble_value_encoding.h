@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/// Binary encoding of the value of a characteristic.
+enum class BLEValueEncoding : uint8_t {
+  /// backward compatible encoding without 0x2904 descriptor: float for sensors, uint16 for binary sensors and switches, UTF-8 string for fans and text sensors
+  DEFAULT,
+  /// IEEE-754 32 bit float (little endian)
+  FLOAT32,
+  /// scaled integers (little endian): value = raw value * 10^exponent
+  SINT16,
+  UINT16,
+  SINT32,
+  UINT32,
+  /// Bluetooth SIG temperature: sint16 in 0.01 degrees Celsius
+  TEMPERATURE,
+  /// Bluetooth SIG humidity: uint16 in 0.01 percent
+  HUMIDITY,
+  /// Bluetooth SIG pressure: uint32 in 0.1 Pascal
+  PRESSURE,
+  /// packed binary structure (component specific, e.g. for fans)
+  PACKED,
+};
+
+/// Contents of a characteristic presentation format descriptor (0x2904).
+struct BLEPresentationFormat {
+  /// format (see GATT format types, e.g. 0x14 for float32)
+  uint8_t format;
+  int8_t exponent;
+  /// unit UUID (see GATT units, e.g. 0x272F for degrees Celsius)
+  uint16_t unit;
+};
+
+// GATT format types
+static const uint8_t BLE_FORMAT_BOOLEAN = 0x01;
+static const uint8_t BLE_FORMAT_UINT8 = 0x04;
+static const uint8_t BLE_FORMAT_UINT16 = 0x06;
+static const uint8_t BLE_FORMAT_UINT32 = 0x08;
+static const uint8_t BLE_FORMAT_SINT16 = 0x0E;
+static const uint8_t BLE_FORMAT_SINT32 = 0x10;
+static const uint8_t BLE_FORMAT_FLOAT32 = 0x14;
+static const uint8_t BLE_FORMAT_UTF8 = 0x19;
+static const uint8_t BLE_FORMAT_STRUCT = 0x1B;
+
+// GATT units
+static const uint16_t BLE_UNIT_UNITLESS = 0x2700;
+static const uint16_t BLE_UNIT_PASCAL = 0x2724;
+static const uint16_t BLE_UNIT_CELSIUS = 0x272F;
+static const uint16_t BLE_UNIT_PERCENTAGE = 0x27AD;
+
+/// Maximum number of bytes needed to encode a float value.
+static const size_t BLE_MAX_ENCODED_FLOAT_SIZE = 4;
+
+/**
+ * Encodes the given float value into the buffer (which must hold at least BLE_MAX_ENCODED_FLOAT_SIZE bytes).
+ * Values that are out of range are clamped, NaN is encoded as "value unknown" (the minimum value for signed types, the maximum value for unsigned types).
+ * Encodings that are not applicable to floats fall back to FLOAT32.
+ * @return the number of bytes written
+ */
+size_t encode_float_value(float value, BLEValueEncoding encoding, int8_t exponent, uint8_t* buffer);
+
+/// @return the exponent actually used by the given encoding (Bluetooth SIG types have a fixed exponent)
+int8_t get_effective_exponent(BLEValueEncoding encoding, int8_t exponent);
+
+/// @return the presentation format for a value encoded with the given (non-default) encoding
+BLEPresentationFormat get_presentation_format(BLEValueEncoding encoding, int8_t exponent);
+
+} // namespace esp32_ble_controller
+} // namespace esphome
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+/**
+ * Move-only callable without arguments and return value that stores the wrapped function object inline.
+ * In contrast to std::function it never falls back to the heap: function objects (e.g. lambdas with their captures) that do not fit
+ * into the inline storage are rejected at compile time.
+ * @brief Heap-free std::function<void()> replacement for functions deferred to the main loop
+ */
+class DeferredFunction {
+public:
+  /// Maximum size of the wrapped function object (a lambda capturing two pointers and a string fits).
+  static const size_t INLINE_STORAGE_SIZE = 2 * sizeof(void*) + sizeof(std::string);
+
+  DeferredFunction() : invoker(nullptr), manager(nullptr) {}
+
+  template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, DeferredFunction>::value>::type>
+  DeferredFunction(F&& function) : invoker(&invoke<typename std::decay<F>::type>), manager(&manage<typename std::decay<F>::type>) {
+    using Function = typename std::decay<F>::type;
+    static_assert(sizeof(Function) <= INLINE_STORAGE_SIZE, "function object too large for DeferredFunction, capture less state");
+    static_assert(alignof(Function) <= alignof(std::max_align_t), "function object alignment not supported by DeferredFunction");
+    new (storage) Function(std::forward<F>(function));
+  }
+
+  DeferredFunction(DeferredFunction&& other) : invoker(nullptr), manager(nullptr) { move_from(other); }
+
+  DeferredFunction& operator=(DeferredFunction&& other) {
+    if (this != &other) {
+      reset();
+      move_from(other);
+    }
+    return *this;
+  }
+
+  DeferredFunction(const DeferredFunction&) = delete;
+  DeferredFunction& operator=(const DeferredFunction&) = delete;
+
+  ~DeferredFunction() { reset(); }
+
+  void operator()() { invoker(storage); }
+
+  explicit operator bool() const { return invoker != nullptr; }
+
+  /// Destroys the wrapped function object (if any), afterwards this deferred function is empty.
+  void reset() {
+    if (manager != nullptr) {
+      manager(Operation::DESTROY, storage, nullptr);
+    }
+    invoker = nullptr;
+    manager = nullptr;
+  }
+
+private:
+  enum class Operation { MOVE, DESTROY };
+
+  using Invoker = void (*)(void* storage);
+  using Manager = void (*)(Operation operation, void* storage, void* source_storage);
+
+  template <typename Function>
+  static void invoke(void* storage) { (*static_cast<Function*>(storage))(); }
+
+  template <typename Function>
+  static void manage(Operation operation, void* storage, void* source_storage) {
+    if (operation == Operation::MOVE) {
+      Function* source = static_cast<Function*>(source_storage);
+      new (storage) Function(std::move(*source));
+      source->~Function();
+    } else {
+      static_cast<Function*>(storage)->~Function();
+    }
+  }
+
+  void move_from(DeferredFunction& other) {
+    if (other.manager != nullptr) {
+      other.manager(Operation::MOVE, storage, other.storage);
+    }
+    invoker = other.invoker;
+    manager = other.manager;
+    other.invoker = nullptr;
+    other.manager = nullptr;
+  }
+
+  alignas(std::max_align_t) unsigned char storage[INLINE_STORAGE_SIZE];
+  Invoker invoker;
+  Manager manager;
+};
+
+} // namespace esp32_ble_controller
+} // namespace esphome
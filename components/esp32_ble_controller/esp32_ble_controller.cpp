@@ -1,8 +1,11 @@
+#include <algorithm>
+
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <BLESecurity.h>
 
 #include "esphome/core/application.h"
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
 
 #include <esp_bt_main.h>
@@ -14,6 +17,7 @@
 #include "ble_utils.h"
 #include "ble_command.h"
 #include "automation.h"
+#include "ble_aggregate_handler.h"
 #include "ble_component_handler_factory.h"
 
 namespace esphome {
@@ -21,17 +25,26 @@ namespace esp32_ble_controller {
 
 static const char *TAG = "esp32_ble_controller";
 
-ESP32BLEController::ESP32BLEController() : maintenance_handler(new BLEMaintenanceHandler()) {}
+/// maximum time spent per loop iteration for setting up the characteristics or starting the services of components (at least one per iteration)
+static const uint32_t SETUP_TIME_SLICE_US = 10000;
 
-/// pre-setup configuration ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// number of handles of a service created by the BLE library by default
+static const uint16_t DEFAULT_SERVICE_HANDLES = 15;
+/// delay before the services are added or removed after switching the BLE mode, so that the result of a command is still delivered
+static const uint32_t BLE_MODE_SWITCH_DELAY_MILLIS = 500;
 
-void ESP32BLEController::register_component(EntityBase* component, const string& serviceUUID, const string& characteristic_UUID, bool use_BLE2902) {
-  BLECharacteristicInfoForHandler info;
-  info.service_UUID = serviceUUID;
-  info.characteristic_UUID = characteristic_UUID;
-  info.use_BLE2902 = use_BLE2902;
+static const char* const SETUP_PHASE_NAMES[BLE_SETUP_PHASE_COUNT] = { "stack", "device", "maintenance service", "component services", "aggregates", "component services start", "advertising" };
 
-  info_for_component[component->get_object_id()] = info;
+ESP32BLEController::ESP32BLEController() : maintenance_handler(new BLEMaintenanceHandler()) {
+  for (size_t i = 0; i < BLE_CONNECTION_PROFILE_COUNT; ++i) {
+    connection_parameters[i] = get_default_connection_parameters(static_cast<BLEConnectionProfile>(i));
+  }
+}
+
+/// pre-setup configuration ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ESP32BLEController::register_component(EntityBase* component, BLEComponentKind kind, const BLECharacteristicInfoForHandler& characteristic_info) {
+  registrations.push_back({component, kind, &characteristic_info});
 }
 
 void ESP32BLEController::ESP32BLEController::register_command(const string& name, const string& description, BLEControllerCustomCommandExecutionTrigger* trigger) {
@@ -71,6 +84,10 @@ void ESP32BLEController::set_maintenance_service_exposed_after_flash(bool expose
   initial_ble_mode_after_flashing = set_feature(initial_ble_mode_after_flashing, BLEMaintenanceMode::MAINTENANCE_SERVICE, exposed);    
 }
 
+void ESP32BLEController::set_connection_parameters(BLEConnectionProfile profile, uint16_t min_interval, uint16_t max_interval, uint16_t latency, uint16_t timeout, uint16_t min_advertising_interval, uint16_t max_advertising_interval, int8_t tx_power) {
+  connection_parameters[static_cast<uint8_t>(profile)] = { min_interval, max_interval, latency, timeout, min_advertising_interval, max_advertising_interval, tx_power };
+}
+
 void ESP32BLEController::set_security_enabled(bool enabled) {
   set_security_mode(BLESecurityMode::SECURE);
 }
@@ -80,41 +97,95 @@ void ESP32BLEController::set_security_enabled(bool enabled) {
 void ESP32BLEController::setup() {
   ESP_LOGCONFIG(TAG, "Setting up BLE controller ...");
 
+  loop_task = xTaskGetCurrentTaskHandle();
   initialize_ble_mode();
 
-  if (ble_mode == BLEMaintenanceMode::NONE) {
-    ESP_LOGCONFIG(TAG, "BLE inactive");
-    return;
+  // also without BLE, so that it can be switched on at runtime
+  if (global_ble_controller == nullptr) {
+    global_ble_controller = this;
+  } else {
+    ESP_LOGE(TAG, "Already have an instance of the BLE controller");
   }
 
+  // also without BLE, so that the stored configuration applies and the WIFI commands work once BLE is switched on at runtime
   #ifdef USE_WIFI
   wifi_configuration_handler.setup();
   #endif
 
-  if (!setup_ble()) {
+  if (ble_mode == BLEMaintenanceMode::NONE) {
+    ESP_LOGCONFIG(TAG, "BLE inactive");
+    setup_phase = BLESetupPhase::DONE;
     return;
   }
 
-  if (global_ble_controller == nullptr) {
-    global_ble_controller = this;
-  } else {
-    ESP_LOGE(TAG, "Already have an instance of the BLE controller");
-  }
+  // the BLE stack and the services are set up from the loop (see run_setup_phase())
+  setup_start_millis = millis();
+}
 
-  // Create the BLE Device
-  BLEDevice::init(App.get_name());
+void ESP32BLEController::run_setup_phase() {
+  const uint32_t start = micros();
+  const BLESetupPhase phase = setup_phase;
+  bool phase_complete = true;
 
-  configure_ble_security();
+  switch (phase) {
+    case BLESetupPhase::STACK:
+      if (!setup_ble()) {
+        setup_phase = BLESetupPhase::FAILED;
+        return;
+      }
+      break;
+    case BLESetupPhase::DEVICE:
+      setup_ble_device_and_server();
+      break;
+    case BLESetupPhase::MAINTENANCE_SERVICE:
+      if (get_maintenance_service_exposed()) {
+        maintenance_handler->setup(ble_server);
+      }
+      break;
+    case BLESetupPhase::COMPONENT_SERVICES:
+      phase_complete = !get_component_services_exposed() || setup_ble_services_for_components(start);
+      break;
+    case BLESetupPhase::AGGREGATES:
+      if (get_component_services_exposed()) {
+        setup_ble_services_for_aggregates();
+      }
+      break;
+    case BLESetupPhase::COMPONENT_SERVICES_START:
+      phase_complete = !get_component_services_exposed() || start_ble_services_for_components(start);
+      break;
+    case BLESetupPhase::ADVERTISING:
+      apply_advertising_parameters();
+      BLEDevice::startAdvertising();
+      break;
+    default:
+      return;
+  }
 
-  setup_ble_server_and_services();
+  setup_phase_durations_us[static_cast<size_t>(phase)] += micros() - start;
+  if (phase_complete) {
+    setup_phase = static_cast<BLESetupPhase>(static_cast<uint8_t>(phase) + 1);
+    if (setup_phase == BLESetupPhase::DONE) {
+      setup_duration_millis = millis() - setup_start_millis;
+      log_setup_durations();
+      // the services have changed for clients connected while the phases ran again (see switch_ble_mode())
+      if (connections.get_count() > 0) {
+        indicate_service_changed();
+      }
+    }
+  }
+}
 
-  // Start advertising
-  // BLEAdvertising* advertising = BLEDevice::getAdvertising();
-  // advertising->setMinInterval(0x800); // suggested default: 1.28s
-  // advertising->setMaxInterval(0x800);
-  // advertising->setMinPreferred(80); // = 100 ms, see https://www.novelbits.io/ble-connection-intervals/, https://www.novelbits.io/bluetooth-low-energy-advertisements-part-1/
-  // advertising->setMaxPreferred(800); // = 1000 ms
-  BLEDevice::startAdvertising();
+void ESP32BLEController::log_setup_durations() {
+  if (setup_phase == BLESetupPhase::DONE) {
+    ESP_LOGCONFIG(TAG, "  setup completed after %u ms", setup_duration_millis);
+  } else if (setup_phase == BLESetupPhase::FAILED) {
+    ESP_LOGCONFIG(TAG, "  setup failed (phase %s)", SETUP_PHASE_NAMES[static_cast<size_t>(BLESetupPhase::STACK)]);
+  } else {
+    ESP_LOGCONFIG(TAG, "  setup in progress (phase %s)", SETUP_PHASE_NAMES[static_cast<size_t>(setup_phase)]);
+  }
+  for (size_t i = 0; i < BLE_SETUP_PHASE_COUNT; ++i) {
+    ESP_LOGCONFIG(TAG, "    %s: %u us", SETUP_PHASE_NAMES[i], setup_phase_durations_us[i]);
+  }
 }
 
 bool ESP32BLEController::setup_ble() {
@@ -151,134 +222,246 @@ bool ESP32BLEController::setup_ble() {
   return true;
 }
 
-void ESP32BLEController::setup_ble_server_and_services() {
+void ESP32BLEController::setup_ble_device_and_server() {
+  // Create the BLE Device
+  BLEDevice::init(App.get_name());
+  BLEDevice::setMTU(preferred_mtu);
+
+  configure_ble_security();
+
   ble_server = BLEDevice::createServer();
-  ble_server->setCallbacks(this);
+  BLEDevice::setCustomGattsHandler([](esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param) {
+    global_ble_controller->on_gatts_event(event, param);
+  });
+  BLEDevice::setCustomGapHandler([](esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+    global_ble_controller->on_gap_event(event, param);
+  });
+  ble_device_initialized = true;
+}
 
-  if (get_maintenance_service_exposed()) {
-    maintenance_handler->setup(ble_server);
+bool ESP32BLEController::setup_ble_services_for_components(uint32_t slice_start_us) {
+  if (next_registration == 0) {
+    create_ble_services_for_components();
   }
 
-  if (get_component_services_exposed()) {
-    setup_ble_services_for_components();
+  // at least one component per loop iteration, more while the time slice lasts
+  do {
+    if (next_registration == registrations.size()) {
+      return true;
+    }
+    setup_ble_service_for_registration(registrations[next_registration++]);
+  } while (micros() - slice_start_us < SETUP_TIME_SLICE_US);
+
+  return next_registration == registrations.size();
+}
+
+void ESP32BLEController::create_ble_services_for_components() {
+  // the code generation has counted the handles, so that no service runs out of handles however many characteristics it has
+  for (const auto* service_info : service_infos) {
+    BLEService* service = ble_server->createService(to_ble_uuid(service_info->UUID), service_info->num_handles);
+    component_services.emplace_back(service, service_info->num_handles);
+    ESP_LOGCONFIG(TAG, "Created service %s with %u handles", service->getUUID().toString().c_str(), service_info->num_handles);
+  }
+}
+
+BLEService* ESP32BLEController::get_ble_service_for_component(const BLEUUIDBytes& service_UUID) {
+  BLEUUID uuid = to_ble_uuid(service_UUID);
+  for (const auto& service : component_services) {
+    if (service.first->getUUID().equals(uuid)) {
+      return service.first;
+    }
   }
+
+  // not counted by the code generation, so the default number of handles has to do
+  ESP_LOGW(TAG, "No handle count for service %s", uuid.toString().c_str());
+  BLEService* service = ble_server->createService(uuid, DEFAULT_SERVICE_HANDLES);
+  component_services.emplace_back(service, DEFAULT_SERVICE_HANDLES);
+  return service;
+}
+
+bool ESP32BLEController::start_ble_services_for_components(uint32_t slice_start_us) {
+  // starting a service creates all its characteristics and descriptors in the BLE stack, so each service is started once
+  do {
+    if (next_service_to_start == component_services.size()) {
+      return true;
+    }
+    component_services[next_service_to_start++].first->start();
+  } while (micros() - slice_start_us < SETUP_TIME_SLICE_US);
+
+  return next_service_to_start == component_services.size();
 }
 
-void ESP32BLEController::setup_ble_services_for_components() {
+void ESP32BLEController::setup_ble_service_for_registration(const BLEComponentRegistration& registration) {
+  if (registration.characteristic_info->is_aggregate) {
+    add_component_to_aggregate(registration);
+    return;
+  }
+
+  switch (registration.kind) {
 #ifdef USE_BINARY_SENSOR
-  setup_ble_services_for_components(App.get_binary_sensors(), BLEComponentHandlerFactory::create_binary_sensor_handler);
-#endif
-#ifdef USE_COVER
-  //setup_ble_services_for_components(App.get_covers());
+    case BLEComponentKind::BINARY_SENSOR:
+      setup_ble_service_for_component(registration, BLEComponentHandlerFactory::create_binary_sensor_handler);
+      break;
 #endif
 #ifdef USE_FAN
-  setup_ble_services_for_components(App.get_fans(), BLEComponentHandlerFactory::create_fan_handler);
-#endif
-#ifdef USE_LIGHT
-  //setup_ble_services_for_components(App.get_lights());
+    case BLEComponentKind::FAN:
+      setup_ble_service_for_component(registration, BLEComponentHandlerFactory::create_fan_handler);
+      break;
 #endif
 #ifdef USE_SENSOR
-  setup_ble_services_for_components(App.get_sensors(), BLEComponentHandlerFactory::create_sensor_handler);
+    case BLEComponentKind::SENSOR:
+      setup_ble_service_for_component(registration, BLEComponentHandlerFactory::create_sensor_handler);
+      break;
 #endif
 #ifdef USE_SWITCH
-  setup_ble_services_for_components(App.get_switches(), BLEComponentHandlerFactory::create_switch_handler);
+    case BLEComponentKind::SWITCH:
+      setup_ble_service_for_component(registration, BLEComponentHandlerFactory::create_switch_handler);
+      break;
 #endif
 #ifdef USE_TEXT_SENSOR
-  setup_ble_services_for_components(App.get_text_sensors(), BLEComponentHandlerFactory::create_text_sensor_handler);
-#endif
-#ifdef USE_CLIMATE
-  //setup_ble_services_for_components(App.get_climates());
+    case BLEComponentKind::TEXT_SENSOR:
+      setup_ble_service_for_component(registration, BLEComponentHandlerFactory::create_text_sensor_handler);
+      break;
 #endif
+    default:
+      ESP_LOGW(TAG, "Component %s cannot be exposed via BLE (not supported)", registration.component->get_object_id().c_str());
+      break;
+  }
+}
+
+void ESP32BLEController::setup_ble_services_for_aggregates() {
+  const size_t component_count = handlers.size();
 
-  for (auto const& entry : handler_for_component) {
-    auto* handler = entry.second;
-    handler->setup(ble_server);
+  // the aggregates are set up once all their components are known
+  for (auto* aggregate_handler : aggregate_handlers) {
+    aggregate_handler->setup(get_ble_service_for_component(aggregate_handler->get_characteristic_info().service_UUID));
+    handlers.push_back(aggregate_handler);
   }
 
-  register_state_change_callbacks_and_send_initial_states();
+  ESP_LOGCONFIG(TAG, "%d components exposed, %d aggregates", component_count, aggregate_handlers.size());
+  aggregate_handlers.clear();
 }
 
-template <typename C> 
-void ESP32BLEController::setup_ble_services_for_components(const vector<C*>& components, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&)) {
-  for (C* component: components) {
-    setup_ble_service_for_component(component, handler_creator);
+void ESP32BLEController::add_component_to_aggregate(const BLEComponentRegistration& registration) {
+  // all components of an aggregate are registered with the same characteristic info
+  BLEAggregateHandler* aggregate_handler = nullptr;
+  for (auto* candidate : aggregate_handlers) {
+    if (&candidate->get_characteristic_info() == registration.characteristic_info) {
+      aggregate_handler = candidate;
+      break;
+    }
+  }
+  if (aggregate_handler == nullptr) {
+    aggregate_handler = new BLEAggregateHandler(*registration.characteristic_info);
+    aggregate_handlers.push_back(aggregate_handler);
+  }
+
+  // Note: The kind of the registration guarantees the type of the component.
+  switch (registration.kind) {
+#ifdef USE_BINARY_SENSOR
+    case BLEComponentKind::BINARY_SENSOR:
+      add_component_to_aggregate(static_cast<binary_sensor::BinarySensor*>(registration.component), aggregate_handler);
+      break;
+#endif
+#ifdef USE_SENSOR
+    case BLEComponentKind::SENSOR:
+      add_component_to_aggregate(static_cast<sensor::Sensor*>(registration.component), aggregate_handler);
+      break;
+#endif
+#ifdef USE_SWITCH
+    case BLEComponentKind::SWITCH:
+      add_component_to_aggregate(static_cast<switch_::Switch*>(registration.component), aggregate_handler);
+      break;
+#endif
+    default:
+      ESP_LOGW(TAG, "Component %s cannot be aggregated (not supported)", registration.component->get_object_id().c_str());
+      break;
   }
 }
 
 template <typename C> 
-void ESP32BLEController::setup_ble_service_for_component(C* component, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&)) {
+void ESP32BLEController::setup_ble_service_for_component(const BLEComponentRegistration& registration, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&)) {
   static_assert(std::is_base_of<EntityBase, C>::value, "EntityBase subclasses expected");
 
-  auto object_id = component->get_object_id();
-  if (info_for_component.count(object_id)) {
-    auto info = info_for_component[object_id];
-    handler_for_component[object_id] = handler_creator(component, info);
+  // Note: The kind of the registration guarantees that the component is a C.
+  C* component = static_cast<C*>(registration.component);
+
+  BLEComponentHandlerBase* handler = handler_creator(component, *registration.characteristic_info);
+  handler->setup(get_ble_service_for_component(registration.characteristic_info->service_UUID));
+  handlers.push_back(handler);
+
+  register_state_change_callback_and_send_initial_state(component, handler);
+}
+
+template <typename C> 
+void ESP32BLEController::add_component_to_aggregate(C* component, BLEAggregateHandler* aggregate_handler) {
+  size_t index;
+  if (aggregate_handler->add_member(component, index)) {
+    register_state_change_callback_and_send_initial_state(component, aggregate_handler, index);
   }
 }
 
-void ESP32BLEController::register_state_change_callbacks_and_send_initial_states() {
 #ifdef USE_BINARY_SENSOR
-  for (auto *obj : App.get_binary_sensors()) {
-    if (info_for_component.count(obj->get_object_id())) {
-      obj->add_on_state_callback([this, obj](bool state) { this->on_binary_sensor_update(obj, state); });
-      if (obj->has_state())
-        update_component_state(obj, obj->state);
-    }
-  }
-#endif
-#ifdef USE_CLIMATE
-  // for (auto *obj : App.get_climates()) {
-  //   if (info_for_component.count(obj->get_object_id()))
-  //     obj->add_on_state_callback([this, obj]() { this->on_climate_update(obj); });
-  // }
-#endif
-#ifdef USE_COVER
-  // for (auto *obj : App.get_covers()) {
-  //   if (info_for_component.count(obj->get_object_id()))
-  //     obj->add_on_state_callback([this, obj]() { this->on_cover_update(obj); });
-  // }
+void ESP32BLEController::register_state_change_callback_and_send_initial_state(binary_sensor::BinarySensor* component, BLEComponentHandlerBase* handler) {
+  component->add_on_state_callback([handler](bool state) { handler->send_value(state); });
+  handler->set_state_encoder([handler, component]() { handler->encode_value(component->state); }, true);
+  if (component->has_state())
+    handler->send_value(component->state);
+}
 #endif
 #ifdef USE_FAN
-  for (auto *obj : App.get_fans()) {
-    if (info_for_component.count(obj->get_object_id())) {
-      obj->add_on_state_callback([this, obj]() { this->on_fan_update(obj); });
-      update_component_state(obj, obj->state);
-    }
-  }
-#endif
-#ifdef USE_LIGHT
-  // for (auto *obj : App.get_lights()) {
-  //   if (info_for_component.count(obj->get_object_id()))
-  //     obj->add_new_remote_values_callback([this, obj]() { this->on_light_update(obj); });
-  // }
+void ESP32BLEController::register_state_change_callback_and_send_initial_state(fan::Fan* component, BLEComponentHandlerBase* handler) {
+  component->add_on_state_callback([handler, component]() { handler->send_value(component->state); });
+  // the encoded value is a string built from the fan state (speed, oscillation, ...), which the loop may change meanwhile
+  handler->set_state_encoder([handler, component]() { handler->encode_value(component->state); }, false);
+  handler->send_value(component->state);
+}
 #endif
 #ifdef USE_SENSOR
-  for (auto *obj : App.get_sensors()) {
-    if (info_for_component.count(obj->get_object_id())) {
-      obj->add_on_state_callback([this, obj](float state) { this->on_sensor_update(obj, state); });
-      if (obj->has_state())
-        update_component_state(obj, obj->state);
-    }
-  }
+void ESP32BLEController::register_state_change_callback_and_send_initial_state(sensor::Sensor* component, BLEComponentHandlerBase* handler) {
+  component->add_on_state_callback([handler](float state) { handler->send_value(state); });
+  handler->set_state_encoder([handler, component]() { handler->encode_value(component->state); }, true);
+  if (component->has_state())
+    handler->send_value(component->state);
+}
 #endif
 #ifdef USE_SWITCH
-  for (auto *obj : App.get_switches()) {
-    if (info_for_component.count(obj->get_object_id())) {
-      obj->add_on_state_callback([this, obj](bool state) { this->on_switch_update(obj, state); });
-      update_component_state(obj, obj->state);
-    }
-  }
+void ESP32BLEController::register_state_change_callback_and_send_initial_state(switch_::Switch* component, BLEComponentHandlerBase* handler) {
+  component->add_on_state_callback([handler](bool state) { handler->send_value(state); });
+  handler->set_state_encoder([handler, component]() { handler->encode_value(component->state); }, true);
+  handler->send_value(component->state);
+}
 #endif
 #ifdef USE_TEXT_SENSOR
-  for (auto *obj : App.get_text_sensors()) {
-    if (info_for_component.count(obj->get_object_id())) {
-      obj->add_on_state_callback([this, obj](std::string state) { this->on_text_sensor_update(obj, state); });
-      if (obj->has_state())
-        update_component_state(obj, obj->state);
-    }
-  }
+void ESP32BLEController::register_state_change_callback_and_send_initial_state(text_sensor::TextSensor* component, BLEComponentHandlerBase* handler) {
+  component->add_on_state_callback([handler](const std::string& state) { handler->send_value(state); });
+  // the state string must not be read from the BLE task while the loop may change it
+  handler->set_state_encoder([handler, component]() { handler->encode_value(component->state); }, false);
+  if (component->has_state())
+    handler->send_value(component->state);
+}
 #endif
+
+#ifdef USE_BINARY_SENSOR
+void ESP32BLEController::register_state_change_callback_and_send_initial_state(binary_sensor::BinarySensor* component, BLEAggregateHandler* handler, size_t index) {
+  component->add_on_state_callback([handler, index](bool state) { handler->send_value(index, state); });
+  if (component->has_state())
+    handler->send_value(index, component->state);
 }
+#endif
+#ifdef USE_SENSOR
+void ESP32BLEController::register_state_change_callback_and_send_initial_state(sensor::Sensor* component, BLEAggregateHandler* handler, size_t index) {
+  component->add_on_state_callback([handler, index](float state) { handler->send_value(index, state); });
+  if (component->has_state())
+    handler->send_value(index, component->state);
+}
+#endif
+#ifdef USE_SWITCH
+void ESP32BLEController::register_state_change_callback_and_send_initial_state(switch_::Switch* component, BLEAggregateHandler* handler, size_t index) {
+  component->add_on_state_callback([handler, index](bool state) { handler->send_value(index, state); });
+  handler->send_value(index, component->state);
+}
+#endif
 
 void ESP32BLEController::initialize_ble_mode() {
   // Note: We include the compilation time to force a reset after flashing new firmware
@@ -287,27 +470,255 @@ void ESP32BLEController::initialize_ble_mode() {
   if (!ble_mode_preference.load(&ble_mode)) {
     ble_mode = initial_ble_mode_after_flashing;
   }
+  requested_ble_mode = ble_mode;
 
   ESP_LOGCONFIG(TAG, "BLE mode: %d", static_cast<uint8_t>(ble_mode));
 }
 
 void ESP32BLEController::switch_ble_mode(BLEMaintenanceMode newMode) {
-  if (ble_mode != newMode) {
-    ESP_LOGI(TAG, "Switching BLE mode to %d and rebooting", static_cast<uint8_t>(newMode));
+  if (requested_ble_mode == newMode) {
+    return;
+  }
 
-    ble_mode = newMode;
-    ble_mode_preference.save(&ble_mode);
+  requested_ble_mode = newMode;
+  ble_mode_preference.save(&requested_ble_mode);
 
+  // during setup the phases have already decided on the services, and a released BLE controller cannot be started again
+  if (setup_phase != BLESetupPhase::DONE || ble_controller_memory_released) {
+    ESP_LOGI(TAG, "Switching BLE mode to %d and rebooting", static_cast<uint8_t>(newMode));
+    ble_mode = newMode;
     App.safe_reboot();
+    return;
   }
+
+  ESP_LOGI(TAG, "Switching BLE mode to %d", static_cast<uint8_t>(newMode));
+  // several switches in a row are applied at once (with the latest requested mode)
+  App.scheduler.set_timeout(this, "ble-mode", BLE_MODE_SWITCH_DELAY_MILLIS, [this]() { apply_ble_mode(requested_ble_mode); });
 }
 
 void ESP32BLEController::switch_maintenance_service_exposed(bool exposed) {
-  switch_ble_mode(set_feature(ble_mode, BLEMaintenanceMode::MAINTENANCE_SERVICE, exposed));
+  switch_ble_mode(set_feature(requested_ble_mode, BLEMaintenanceMode::MAINTENANCE_SERVICE, exposed));
 }
 
 void ESP32BLEController::switch_component_services_exposed(bool exposed) {
-  switch_ble_mode(set_feature(ble_mode, BLEMaintenanceMode::COMPONENT_SERVICES, exposed));
+  switch_ble_mode(set_feature(requested_ble_mode, BLEMaintenanceMode::COMPONENT_SERVICES, exposed));
+}
+
+void ESP32BLEController::apply_ble_mode(BLEMaintenanceMode mode) {
+  const BLEMaintenanceMode previous_mode = ble_mode;
+  if (mode == previous_mode) {
+    return;
+  }
+  ble_mode = mode;
+
+  if (mode == BLEMaintenanceMode::NONE) {
+    shut_down_ble();
+    return;
+  }
+  if (previous_mode == BLEMaintenanceMode::NONE) {
+    // BLE has not been started since boot
+    restart_setup_phases(BLESetupPhase::STACK);
+    return;
+  }
+
+  const uint8_t changes = static_cast<uint8_t>(previous_mode) ^ static_cast<uint8_t>(mode);
+  if (changes & static_cast<uint8_t>(BLEMaintenanceMode::MAINTENANCE_SERVICE)) {
+    if (get_maintenance_service_exposed()) {
+      maintenance_handler->setup(ble_server);
+    } else {
+      maintenance_handler->remove_service();
+    }
+  }
+  if (changes & static_cast<uint8_t>(BLEMaintenanceMode::COMPONENT_SERVICES)) {
+    if (get_component_services_exposed()) {
+      add_component_services();
+    } else {
+      remove_component_services();
+    }
+  }
+
+  // while the setup phases run again, the indication is sent when they are done
+  if (setup_phase == BLESetupPhase::DONE) {
+    indicate_service_changed();
+  }
+}
+
+void ESP32BLEController::restart_setup_phases(BLESetupPhase phase) {
+  setup_phase = phase;
+  setup_start_millis = millis();
+  for (auto& duration : setup_phase_durations_us) {
+    duration = 0;
+  }
+}
+
+void ESP32BLEController::add_component_services() {
+  if (handlers.empty()) {
+    // the components have not been set up since boot
+    next_service_to_start = 0;
+    restart_setup_phases(BLESetupPhase::COMPONENT_SERVICES);
+    return;
+  }
+
+  ESP_LOGI(TAG, "Adding the services of %d components", handlers.size());
+  // the characteristics of removed services cannot be created again, so the handlers get new ones
+  create_ble_services_for_components();
+  for (auto* handler : handlers) {
+    handler->setup(get_ble_service_for_component(handler->get_characteristic_info().service_UUID));
+  }
+  for (const auto& service : component_services) {
+    service.first->start();
+  }
+}
+
+void ESP32BLEController::remove_component_services() {
+  ESP_LOGI(TAG, "Removing the services of %d components", handlers.size());
+  for (const auto& service : component_services) {
+    remove_service(service.first, service.second);
+  }
+  component_services.clear();
+  for (auto* handler : handlers) {
+    handler->delete_characteristic();
+  }
+}
+
+void ESP32BLEController::remove_service(BLEService* service, uint16_t num_handles) {
+  // services added later may get the same handles
+  const uint16_t first_handle = service->getHandle();
+  connections.remove_subscriptions(first_handle, first_handle + num_handles - 1);
+  // removes the service from the stack and the server, but the objects are left to us (their characteristics are deleted by their owners)
+  ble_server->removeService(service);
+  delete service;
+}
+
+void ESP32BLEController::indicate_service_changed() {
+  // clients that have subscribed to the Service Changed characteristic discover the services again
+  esp_err_t err = esp_ble_gatts_send_service_change_indication(ble_server->getGattsIf(), nullptr);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Service Changed indication failed: %d", err);
+  }
+}
+
+void ESP32BLEController::shut_down_ble() {
+  ESP_LOGI(TAG, "Shutting down BLE");
+
+  App.scheduler.cancel_timeout(this, ""); // restart of advertising after a disconnect
+  BLEDevice::stopAdvertising();
+  maintenance_handler->remove_service();
+  // the handlers are kept, because the state callbacks of the components refer to them, but their characteristics are deleted
+  if (!component_services.empty()) {
+    remove_component_services();
+  }
+  connections.clear();
+
+  // releases the memory of the BLE controller for the rest of the application, BLE cannot be started again until reboot
+  BLEDevice::deinit(true);
+  ble_device_initialized = false;
+  ble_server = nullptr;
+  ble_controller_memory_released = true;
+}
+
+void ESP32BLEController::set_connection_profile(BLEConnectionProfile profile) {
+  connection_profile = profile;
+
+  // without the BLE device (before its setup phase, while BLE is inactive, or after shut down) the profile is applied when advertising starts
+  if (ble_device_initialized) {
+    ESP_LOGI(TAG, "Switched to connection profile %s (applied to the next connection)", get_connection_profile_name(profile));
+    apply_advertising_parameters();
+    // restart advertising with the new interval if it is running, i.e. setup is complete and there are free slots
+    if (setup_phase == BLESetupPhase::DONE && connections.get_count() < connections.get_max_connections()) {
+      BLEDevice::stopAdvertising();
+      BLEDevice::startAdvertising();
+    }
+  }
+}
+
+void ESP32BLEController::apply_advertising_parameters() {
+  const BLEConnectionParameters& parameters = get_connection_parameters(connection_profile);
+
+  // see https://www.novelbits.io/ble-connection-intervals/, https://www.novelbits.io/bluetooth-low-energy-advertisements-part-1/
+  BLEAdvertising* advertising = BLEDevice::getAdvertising();
+  advertising->setMinInterval(parameters.min_advertising_interval);
+  advertising->setMaxInterval(parameters.max_advertising_interval);
+  advertising->setMinPreferred(parameters.min_interval);
+  advertising->setMaxPreferred(parameters.max_interval);
+
+  // the levels start with ESP_PWR_LVL_N12 (-12dBm) in steps of 3dBm, the default level applies to connections established from now on
+  const esp_power_level_t power_level = static_cast<esp_power_level_t>((parameters.tx_power + 12) / 3);
+  BLEDevice::setPower(power_level, ESP_BLE_PWR_TYPE_ADV);
+  BLEDevice::setPower(power_level, ESP_BLE_PWR_TYPE_DEFAULT);
+}
+
+void ESP32BLEController::request_connection_parameters(esp_bd_addr_t address) {
+  const BLEConnectionParameters& parameters = get_connection_parameters(connection_profile);
+  ble_server->updateConnParams(address, parameters.min_interval, parameters.max_interval, parameters.latency, parameters.timeout);
+}
+
+uint16_t ESP32BLEController::get_mtu() const {
+  return connections.get_min_mtu();
+}
+
+/// @return the handle of the 0x2902 descriptor whose subscriptions determine the clients to notify (0 = all clients)
+static uint16_t get_subscription_handle(BLECharacteristic* characteristic, bool ignore_subscriptions) {
+  if (ignore_subscriptions) {
+    return 0;
+  }
+  BLEDescriptor* descriptor_2902 = characteristic->getDescriptorByUUID(BLEUUID((uint16_t) 0x2902));
+  return descriptor_2902 != nullptr ? descriptor_2902->getHandle() : 0;
+}
+
+bool ESP32BLEController::notify(BLECharacteristic* characteristic, bool ignore_subscriptions, BLETrafficStatistics* statistics) {
+  BLENotificationTarget targets[BLE_MAX_CONNECTIONS];
+  const size_t target_count = connections.get_notification_targets(get_subscription_handle(characteristic, ignore_subscriptions), targets);
+  return send_value_to_clients(characteristic, targets, target_count, false, statistics);
+}
+
+void ESP32BLEController::indicate(BLECharacteristic* characteristic) {
+  BLENotificationTarget targets[BLE_MAX_CONNECTIONS];
+  const size_t target_count = connections.get_notification_targets(get_subscription_handle(characteristic, false), targets, BLE_CCCD_INDICATE);
+  send_value_to_clients(characteristic, targets, target_count, true, nullptr);
+}
+
+bool ESP32BLEController::send_value_to_clients(BLECharacteristic* characteristic, const BLENotificationTarget* targets, size_t target_count, bool indication, BLETrafficStatistics* statistics) {
+  if (target_count == 0) {
+    return false;
+  }
+
+  // the value is sent without holding the lock of the registry, because sending may block while the BLE task delivers events
+  string value = characteristic->getValue();
+  for (size_t i = 0; i < target_count; ++i) {
+    const size_t length = std::min(value.length(), targets[i].max_size);
+    esp_ble_gatts_send_indicate(ble_server->getGattsIf(), targets[i].conn_id, characteristic->getHandle(), length, reinterpret_cast<uint8_t*>(&value[0]), indication);
+
+    ++traffic_statistics.notifications;
+    traffic_statistics.bytes_sent += length;
+    if (statistics != nullptr) {
+      ++statistics->notifications;
+      statistics->bytes_sent += length;
+    }
+  }
+  return true;
+}
+
+bool ESP32BLEController::has_listeners(BLECharacteristic* characteristic, bool ignore_subscriptions) const {
+  // the characteristics of the components are not part of the GATT table while their services are removed (see switch_ble_mode())
+  return get_component_services_exposed() && connections.has_notification_targets(get_subscription_handle(characteristic, ignore_subscriptions));
+}
+
+BLEHandlerStatistics ESP32BLEController::get_handler_statistics_total() const {
+  BLEHandlerStatistics total;
+  for (const auto* handler : handlers) {
+    total += handler->get_statistics();
+  }
+  return total;
+}
+
+void ESP32BLEController::reset_statistics() {
+  traffic_statistics = BLETrafficStatistics();
+  for (auto* handler : handlers) {
+    handler->reset_statistics();
+  }
+  reset_loop_statistics();
+  deferred_functions_for_loop.reset_statistics();
 }
 
 void ESP32BLEController::dump_config() {
@@ -316,8 +727,20 @@ void ESP32BLEController::dump_config() {
   }
   
   ESP_LOGCONFIG(TAG, "Bluetooth Low Energy Controller:");
-  ESP_LOGCONFIG(TAG, "  BLE device address: %s", BLEDevice::getAddress().toString().c_str());
+  // the device is initialized in the setup phases (see run_setup_phase())
+  if (ble_device_initialized) {
+    ESP_LOGCONFIG(TAG, "  BLE device address: %s", BLEDevice::getAddress().toString().c_str());
+  }
   ESP_LOGCONFIG(TAG, "  BLE mode: %d", (uint8_t) ble_mode);
+  log_setup_durations();
+  ESP_LOGCONFIG(TAG, "  deferred functions queue: size %d, overflow policy %d", deferred_functions_for_loop.get_capacity(), (uint8_t) deferred_functions_for_loop.get_overflow_policy());
+  ESP_LOGCONFIG(TAG, "  loop budget: %u us, %u functions (0 = unlimited)", loop_time_budget_us, loop_item_budget);
+  ESP_LOGCONFIG(TAG, "  max connections: %u", connections.get_max_connections());
+  ESP_LOGCONFIG(TAG, "  preferred MTU: %u, preferred data length: %u", preferred_mtu, preferred_data_length);
+  const BLEConnectionParameters& parameters = get_connection_parameters(connection_profile);
+  ESP_LOGCONFIG(TAG, "  connection profile: %s (interval %.2f-%.2f ms, latency %u, timeout %u ms, advertising %.2f-%.2f ms, TX power %d dBm)",
+    get_connection_profile_name(connection_profile), parameters.min_interval * 1.25f, parameters.max_interval * 1.25f, parameters.latency, parameters.timeout * 10,
+    parameters.min_advertising_interval * 0.625f, parameters.max_advertising_interval * 0.625f, parameters.tx_power);
 
   if (get_security_mode() != BLESecurityMode::NONE) {
     if (get_security_mode() == BLESecurityMode::BOND) {
@@ -326,8 +749,10 @@ void ESP32BLEController::dump_config() {
       ESP_LOGCONFIG(TAG, "  security enabled (secure connections, MITM protection)");
     }
 
-    vector<string> bonded_devices = get_bonded_devices();
-    if (bonded_devices.empty()) {
+    vector<string> bonded_devices = ble_device_initialized ? get_bonded_devices() : vector<string>();
+    if (!ble_device_initialized) {
+      ESP_LOGCONFIG(TAG, "  bonded BLE devices not yet known");
+    } else if (bonded_devices.empty()) {
       ESP_LOGCONFIG(TAG, "  no bonded BLE devices");
     } else {
       ESP_LOGCONFIG(TAG, "  bonded BLE devices (%d):", bonded_devices.size());
@@ -363,63 +788,99 @@ void ESP32BLEController::send_command_result(const string& result_message) {
   maintenance_handler->send_command_result(result_message);
 }
 
+static string format_command_result(const char* format, va_list arg) {
+  va_list arg_for_length;
+  va_copy(arg_for_length, arg);
+  const int length = vsnprintf(nullptr, 0, format, arg_for_length);
+  va_end(arg_for_length);
+
+  string result_message;
+  if (length > 0) {
+    result_message.resize(length);
+    vsnprintf(&result_message[0], length + 1, format, arg);
+  }
+  return result_message;
+}
+
 void ESP32BLEController::send_command_result(const char* format, ...) {
-  char buffer[128];
   va_list arg;
   va_start(arg, format);
-  vsnprintf(buffer, sizeof(buffer), format, arg);
+  const string result_message = format_command_result(format, arg);
   va_end(arg);
   
-  maintenance_handler->send_command_result(buffer);
+  maintenance_handler->send_command_result(result_message);
 }
 
-#ifdef USE_BINARY_SENSOR
-  void ESP32BLEController::on_binary_sensor_update(binary_sensor::BinarySensor *obj, bool state) { update_component_state(obj, state); }
-#endif
-#ifdef USE_COVER
-  void ESP32BLEController::on_cover_update(cover::Cover *obj) {}
-#endif
-#ifdef USE_FAN
-  void ESP32BLEController::on_fan_update(fan::Fan *fan) { update_component_state(fan, fan->state); }
-#endif
-#ifdef USE_LIGHT
-  void ESP32BLEController::on_light_update(light::LightState *obj) {}
-#endif
-#ifdef USE_SENSOR
-  void ESP32BLEController::on_sensor_update(sensor::Sensor *component, float state) { update_component_state(component, state); }
-#endif
-#ifdef USE_SWITCH
-  void ESP32BLEController::on_switch_update(switch_::Switch *obj, bool state) { update_component_state(obj, state); }
-#endif
-#ifdef USE_TEXT_SENSOR
-  void ESP32BLEController::on_text_sensor_update(text_sensor::TextSensor *obj, std::string state) { update_component_state(obj, state); }
-#endif
-#ifdef USE_CLIMATE
-  void ESP32BLEController::on_climate_update(climate::Climate *obj) {}
-#endif
-
-template <typename C, typename S> 
-void ESP32BLEController::update_component_state(C* component, S state) {
-  static_assert(std::is_base_of<EntityBase, C>::value, "EntityBase subclasses expected");
+void ESP32BLEController::send_command_result(uint16_t invocation_id, const char* format, ...) {
+  va_list arg;
+  va_start(arg, format);
+  const string result_message = format_command_result(format, arg);
+  va_end(arg);
 
-  auto object_id = component->get_object_id();
-  BLEComponentHandlerBase* handler = handler_for_component[object_id];
-  if (handler != nullptr) {
-    handler->send_value(state);
-  }
+  maintenance_handler->send_command_result(invocation_id, result_message);
 }
 
-void ESP32BLEController::execute_in_loop(std::function<void()>&& deferred_function) {
-  bool ok = deferred_functions_for_loop.push(std::move(deferred_function));
+void ESP32BLEController::execute_in_loop(DeferredFunction&& deferred_function, const void* coalescing_key) {
+  bool ok = deferred_functions_for_loop.push(std::move(deferred_function), coalescing_key);
   if (!ok) {
-    ESP_LOGW(TAG, "Deferred functions queue full");
+    ESP_LOGW(TAG, "Deferred functions queue full (%u dropped so far)", deferred_functions_for_loop.get_dropped_count());
   }
 }
 
 void ESP32BLEController::loop() {
-  std::function<void()> deferred_function;
+  if (setup_phase < BLESetupPhase::DONE) {
+    run_setup_phase();
+    return;
+  }
+  if (ble_mode == BLEMaintenanceMode::NONE || setup_phase == BLESetupPhase::FAILED) {
+    return;
+  }
+
+  execute_deferred_functions();
+
+  if (get_maintenance_service_exposed()) {
+    maintenance_handler->loop();
+  }
+
+  if (get_component_services_exposed()) {
+    for (auto* handler : handlers) {
+      handler->send_pending_notification();
+    }
+  }
+}
+
+void ESP32BLEController::execute_deferred_functions() {
+  const uint32_t start = micros();
+  uint32_t executed = 0;
+  bool budget_exhausted = false;
+
+  DeferredFunction deferred_function;
   while (deferred_functions_for_loop.take(deferred_function)) {
     deferred_function();
+    deferred_function.reset();
+    ++executed;
+
+    // leftover functions stay queued for the next iteration
+    if ((loop_item_budget != 0 && executed >= loop_item_budget) || (loop_time_budget_us != 0 && micros() - start >= loop_time_budget_us)) {
+      budget_exhausted = true;
+      break;
+    }
+  }
+
+  if (executed == 0) {
+    return;
+  }
+
+  const uint32_t duration = micros() - start;
+  const uint32_t backlog = deferred_functions_for_loop.size();
+  loop_statistics.last_duration_us = duration;
+  loop_statistics.max_duration_us = std::max(loop_statistics.max_duration_us, duration);
+  loop_statistics.last_executed = executed;
+  loop_statistics.last_backlog = backlog;
+  loop_statistics.max_backlog = std::max(loop_statistics.max_backlog, backlog);
+  if (budget_exhausted && backlog > 0) {
+    ++loop_statistics.budget_exhausted_count;
+    ESP_LOGV(TAG, "Loop budget exhausted after %u functions (%u us), %u left", executed, duration, backlog);
   }
 }
 
@@ -460,6 +921,7 @@ void ESP32BLEController::onPassKeyNotify(uint32_t pass_key) {
 void ESP32BLEController::onAuthenticationComplete(esp_ble_auth_cmpl_t result) {
   auto& callbacks = on_authentication_complete_callbacks;
   bool success=result.success;
+  connections.set_authenticated(result.bd_addr, success);
   global_ble_controller->execute_in_loop([&callbacks, success](){
     if (success) {
       ESP_LOGD(TAG, "BLE authentication - completed succesfully");
@@ -485,28 +947,110 @@ bool ESP32BLEController::onConfirmPIN(uint32_t pin) {
   return true;
 }
 
-void ESP32BLEController::ESP32BLEController::onConnect(BLEServer* server) {
+void ESP32BLEController::on_client_connected() {
   auto& callbacks = on_connected_callbacks;
-  global_ble_controller->execute_in_loop([&callbacks](){ 
-    ESP_LOGD(TAG, "BLE server - connected");
+  global_ble_controller->execute_in_loop([&callbacks, this](){ 
+    const size_t count = connections.get_count();
+    ESP_LOGD(TAG, "BLE server - connected (%u of %u connections)", count, connections.get_max_connections());
+
+    // the stack stops advertising when a client connects, continue while there are free slots (unless BLE has been shut down meanwhile)
+    if (ble_device_initialized && count < connections.get_max_connections()) {
+      BLEDevice::startAdvertising();
+    }
+
     callbacks.call();
   });
 }
 
-void ESP32BLEController::ESP32BLEController::onDisconnect(BLEServer* server) {
+void ESP32BLEController::on_client_disconnected() {
   auto& callbacks = on_disconnected_callbacks;
   global_ble_controller->execute_in_loop([&callbacks, this](){ 
-    ESP_LOGD(TAG, "BLE server - disconnected");
+    ESP_LOGD(TAG, "BLE server - disconnected (%u connections left)", connections.get_count());
 
-    // after 500ms start advertising again
+    // after 500ms start advertising again (a slot is free now)
     const uint32_t delay_millis = 500;
-    App.scheduler.set_timeout(this, "", delay_millis, []{ BLEDevice::startAdvertising(); });
+    if (ble_device_initialized) {
+      App.scheduler.set_timeout(this, "", delay_millis, []{ BLEDevice::startAdvertising(); });
+    }
 
     callbacks.call(); 
   });
 }
 
+void ESP32BLEController::on_gatts_event(esp_gatts_cb_event_t event, esp_ble_gatts_cb_param_t* param) {
+  switch (event) {
+    case ESP_GATTS_CONNECT_EVT:
+      if (!connections.add(param->connect.conn_id, param->connect.remote_bda)) {
+        const uint16_t conn_id = param->connect.conn_id;
+        execute_in_loop([this, conn_id]() {
+          ESP_LOGW(TAG, "BLE server - maximum number of connections reached, disconnecting client");
+          if (ble_device_initialized) {
+            ble_server->disconnect(conn_id);
+          }
+        });
+      } else {
+        request_connection_parameters(param->connect.remote_bda);
+        if (preferred_data_length > BLE_DEFAULT_DATA_LENGTH) {
+          connections.set_data_length_requested(param->connect.conn_id);
+          esp_ble_gap_set_pkt_data_len(param->connect.remote_bda, preferred_data_length);
+        }
+        on_client_connected();
+      }
+      break;
+    case ESP_GATTS_DISCONNECT_EVT:
+      // a rejected connection has neither been announced nor freed a slot
+      if (connections.remove(param->disconnect.conn_id)) {
+        on_client_disconnected();
+      }
+      break;
+    case ESP_GATTS_MTU_EVT: {
+      connections.set_mtu(param->mtu.conn_id, param->mtu.mtu);
+      const uint16_t conn_id = param->mtu.conn_id;
+      const uint16_t mtu = param->mtu.mtu;
+      execute_in_loop([conn_id, mtu]() { ESP_LOGD(TAG, "BLE server - MTU of connection %u is %u", conn_id, mtu); });
+      break;
+    }
+    case ESP_GATTS_ADD_CHAR_DESCR_EVT: {
+      const esp_bt_uuid_t& uuid = param->add_char_descr.descr_uuid;
+      if (param->add_char_descr.status == ESP_GATT_OK && uuid.len == ESP_UUID_LEN_16 && uuid.uuid.uuid16 == 0x2902) {
+        connections.add_subscription_descriptor(param->add_char_descr.attr_handle);
+      }
+      break;
+    }
+    case ESP_GATTS_WRITE_EVT:
+      if (!param->write.is_prep) {
+        connections.record_write(param->write.conn_id, param->write.handle, param->write.value, param->write.len);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void ESP32BLEController::on_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+  if (event == ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT) {
+    const bool success = param->pkt_data_lenth_cmpl.status == ESP_BT_STATUS_SUCCESS;
+    const uint16_t data_length = param->pkt_data_lenth_cmpl.params.tx_len;
+    connections.complete_data_length_request(success, data_length);
+    execute_in_loop([success, data_length]() {
+      if (success) {
+        ESP_LOGD(TAG, "BLE server - data length is %u", data_length);
+      } else {
+        ESP_LOGD(TAG, "BLE server - data length extension rejected");
+      }
+    });
+  }
+}
+
 ESP32BLEController* global_ble_controller = nullptr;
 
+void send_fragment_to_clients(BLECharacteristic* characteristic, bool indication) {
+  if (indication) {
+    global_ble_controller->indicate(characteristic);
+  } else {
+    global_ble_controller->notify(characteristic);
+  }
+}
+
 } // namespace esp32_ble_controller
 } // namespace esphome
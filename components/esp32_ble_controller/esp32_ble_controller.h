@@ -1,25 +1,28 @@
 #pragma once
 
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 #include <BLEServer.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
 #include "esphome/core/entity_base.h"
 #include "esphome/core/controller.h"
 #include "esphome/core/defines.h"
 #include "esphome/core/preferences.h"
 
 #include "ble_component_handler_base.h"
+#include "ble_connection.h"
 #include "ble_maintenance_handler.h"
+#include "deferred_function.h"
 #include "thread_safe_bounded_queue.h"
 #ifdef USE_WIFI
 #include "wifi_configuration_handler.h"
 #endif
 
 using std::string;
-using std::unordered_map;
 using std::vector;
 
 namespace esphome {
@@ -30,6 +33,44 @@ enum class BLEMaintenanceMode : uint8_t {  MAINTENANCE_SERVICE = 1, COMPONENT_SE
 enum class BLESecurityMode : uint8_t { NONE, SECURE, BOND };
 
 class BLEControllerCustomCommandExecutionTrigger;
+class BLEAggregateHandler;
+
+/// Metrics about draining the deferred functions in the main loop, used to tune the loop budgets.
+struct BLELoopStatistics {
+  /// time spent executing deferred functions in the latest loop iteration (in microseconds)
+  uint32_t last_duration_us{0};
+  /// maximum time spent executing deferred functions in a single loop iteration (in microseconds)
+  uint32_t max_duration_us{0};
+  /// number of deferred functions executed in the latest loop iteration
+  uint32_t last_executed{0};
+  /// number of deferred functions left over for the next loop iteration after the latest loop iteration
+  uint32_t last_backlog{0};
+  /// maximum number of deferred functions left over after a loop iteration
+  uint32_t max_backlog{0};
+  /// number of loop iterations that stopped because a budget was exhausted
+  uint32_t budget_exhausted_count{0};
+};
+
+/// Phases of the setup of the BLE controller, which run from the main loop one after another.
+enum class BLESetupPhase : uint8_t {
+  /// starting the bluetooth controller and bluedroid
+  STACK,
+  /// initializing the BLE device (incl. security) and creating the server
+  DEVICE,
+  MAINTENANCE_SERVICE,
+  /// creating the services and characteristics of the components, spread over several loop iterations
+  COMPONENT_SERVICES,
+  AGGREGATES,
+  /// starting the services of the components, which creates their characteristics in the BLE stack
+  COMPONENT_SERVICES_START,
+  ADVERTISING,
+  DONE,
+  /// the BLE stack could not be started, the setup is not retried (until reboot)
+  FAILED,
+};
+
+/// Number of setup phases (without DONE).
+static const size_t BLE_SETUP_PHASE_COUNT = static_cast<size_t>(BLESetupPhase::DONE);
 
 /**
  * Bluetooth Low Energy controller for ESP32.
@@ -37,19 +78,42 @@ class BLEControllerCustomCommandExecutionTrigger;
  * In addition it provides maintenance features like a BLE commands and logging over BLE.
  * <para>
  * Besides the generic maintenance service, this controller only exposes components over BLE that have been registered before (i.e. configured explicitly in the yaml configuration).
+ * <para>
+ * The BLE stack and the GATT table are set up in phases from the main loop (see BLESetupPhase), so that setup() returns right away and other components do not wait for BLE.
  * @brief BLE controller for ESP32
  */
-class ESP32BLEController : public Component, private BLESecurityCallbacks, private BLEServerCallbacks {
+class ESP32BLEController : public Component, private BLESecurityCallbacks {
 public:
   ESP32BLEController();
   virtual ~ESP32BLEController() {}
 
   // pre-setup configurations
 
-  void register_component(EntityBase* component, const string& service_UUID, const string& characteristic_UUID, bool use_BLE2902 = true);
+  /// Registers a component that is not supported, i.e. it will not be exposed.
+  void register_component(EntityBase* component, const BLECharacteristicInfoForHandler& characteristic_info) { register_component(component, BLEComponentKind::UNSUPPORTED, characteristic_info); }
+#ifdef USE_BINARY_SENSOR
+  void register_component(binary_sensor::BinarySensor* component, const BLECharacteristicInfoForHandler& characteristic_info) { register_component(component, BLEComponentKind::BINARY_SENSOR, characteristic_info); }
+#endif
+#ifdef USE_FAN
+  void register_component(fan::Fan* component, const BLECharacteristicInfoForHandler& characteristic_info) { register_component(component, BLEComponentKind::FAN, characteristic_info); }
+#endif
+#ifdef USE_SENSOR
+  void register_component(sensor::Sensor* component, const BLECharacteristicInfoForHandler& characteristic_info) { register_component(component, BLEComponentKind::SENSOR, characteristic_info); }
+#endif
+#ifdef USE_SWITCH
+  void register_component(switch_::Switch* component, const BLECharacteristicInfoForHandler& characteristic_info) { register_component(component, BLEComponentKind::SWITCH, characteristic_info); }
+#endif
+#ifdef USE_TEXT_SENSOR
+  void register_component(text_sensor::TextSensor* component, const BLECharacteristicInfoForHandler& characteristic_info) { register_component(component, BLEComponentKind::TEXT_SENSOR, characteristic_info); }
+#endif
+
+  /// Registers a service of the components with the number of attribute handles it needs.
+  void register_service(const BLEServiceInfo& service_info) { service_infos.push_back(&service_info); }
 
   void register_command(const string& name, const string& description, BLEControllerCustomCommandExecutionTrigger* trigger);
   const vector<BLECommand*>& get_commands() const;
+  /// @return the command with the given name or nullptr
+  const BLECommand* find_command(const BLEStringRef& name) const { return maintenance_handler->find_command(name); }
 
   void add_on_show_pass_key_callback(std::function<void(string)>&& trigger_function);
   void add_on_authentication_complete_callback(std::function<void(bool)>&& trigger_function);
@@ -58,9 +122,39 @@ public:
 
   void set_maintenance_service_exposed_after_flash(bool exposed);
 
+  /// Enables framing of messages on the maintenance characteristics, so that long command results and log messages are sent in MTU-sized fragments.
+  void set_maintenance_framing(bool enabled) { maintenance_handler->set_framing_enabled(enabled); }
+  /// Sets how results of commands are delivered: notification (default), indication, or read by the client (legacy).
+  void set_command_result_delivery(BLECommandResultDelivery delivery) { maintenance_handler->set_command_result_delivery(delivery); }
+  const BLECommandLatencyStatistics& get_command_latency_statistics() const { return maintenance_handler->get_command_latency_statistics(); }
+  /// Adds the binary RPC characteristic to the maintenance service.
+  void set_maintenance_rpc(bool enabled) { maintenance_handler->set_rpc_enabled(enabled); }
+  /// Adds the binary diagnostics characteristic to the maintenance service.
+  void set_maintenance_diagnostics(bool enabled) { maintenance_handler->set_diagnostics_enabled(enabled); }
+  /// Sets the size of the buffer for log messages sent over BLE (in bytes).
+  void set_log_buffer_size(size_t size) {
+#ifdef USE_LOGGER
+    maintenance_handler->set_log_buffer_size(size);
+#endif
+  }
+  /// Sends level and tag of log messages sent over BLE as binary prefix instead of the textual header.
+  void set_binary_log_prefix(bool binary_prefix) {
+#ifdef USE_LOGGER
+    maintenance_handler->set_binary_log_prefix(binary_prefix);
+#endif
+  }
+
   void set_security_mode(BLESecurityMode mode) { security_mode = mode; }
   inline BLESecurityMode get_security_mode() const { return security_mode; }
 
+  void set_deferred_queue_size(unsigned int size) { deferred_functions_for_loop.set_size(size); }
+  void set_deferred_queue_overflow_policy(QueueOverflowPolicy policy) { deferred_functions_for_loop.set_overflow_policy(policy); }
+
+  /// Sets the maximum time spent per loop iteration for executing deferred functions, 0 means unlimited. (The function that exceeds the budget is completed.)
+  void set_loop_time_budget(uint32_t budget_us) { loop_time_budget_us = budget_us; }
+  /// Sets the maximum number of deferred functions executed per loop iteration, 0 means unlimited.
+  void set_loop_item_budget(uint32_t budget) { loop_item_budget = budget; }
+
   // deprecated
   void set_security_enabled(bool enabled);
   inline bool get_security_enabled() const { return security_mode != BLESecurityMode::NONE; }
@@ -73,6 +167,9 @@ public:
 
   void dump_config() override;
 
+  BLESetupPhase get_setup_phase() const { return setup_phase; }
+  bool is_setup_complete() const { return setup_phase == BLESetupPhase::DONE; }
+
   // run
 
   void loop() override;
@@ -80,9 +177,63 @@ public:
   inline BLEMaintenanceMode get_ble_mode() const { return ble_mode; }
   bool get_maintenance_service_exposed() const { return static_cast<uint8_t>(ble_mode) & static_cast<uint8_t>(BLEMaintenanceMode::MAINTENANCE_SERVICE); }
   bool get_component_services_exposed() const { return static_cast<uint8_t>(ble_mode) & static_cast<uint8_t>(BLEMaintenanceMode::COMPONENT_SERVICES); }
+  /**
+   * Switches the BLE mode and stores it for the next boot. The services are added to or removed from the running GATT server (after a short delay, 
+   * so that the result of a command is still delivered), and connected clients are told via a Service Changed indication.
+   * Switching to NONE shuts BLE down and releases the memory of the BLE controller, so switching it on again afterwards reboots the device.
+   */
   void switch_ble_mode(BLEMaintenanceMode mode);
+  /// @return the BLE mode requested last (it becomes the current mode once the switch has been applied)
+  BLEMaintenanceMode get_requested_ble_mode() const { return requested_ble_mode; }
+  bool get_requested_maintenance_service_exposed() const { return static_cast<uint8_t>(requested_ble_mode) & static_cast<uint8_t>(BLEMaintenanceMode::MAINTENANCE_SERVICE); }
+  bool get_requested_component_services_exposed() const { return static_cast<uint8_t>(requested_ble_mode) & static_cast<uint8_t>(BLEMaintenanceMode::COMPONENT_SERVICES); }
   void switch_maintenance_service_exposed(bool exposed);
   void switch_component_services_exposed(bool exposed);
+  /// Removes the given service from the GATT server at runtime, forgets the subscriptions of clients to its characteristics, and deletes the service (but not its characteristics).
+  void remove_service(BLEService* service, uint16_t num_handles);
+
+  /// Sets the maximum number of clients that may be connected at the same time. Advertising continues while there are free slots.
+  void set_max_connections(size_t max_connections) { connections.set_max_connections(max_connections); }
+  /// @return the number of connected clients
+  size_t get_connection_count() const { return connections.get_count(); }
+  /// Forgets the subscriptions kept for disconnected bonded clients (when the bonds are removed).
+  void clear_bonded_subscriptions() { connections.clear_bonded_subscriptions(); }
+
+  /// Overrides the built-in parameters of a connection profile (pre-setup).
+  void set_connection_parameters(BLEConnectionProfile profile, uint16_t min_interval, uint16_t max_interval, uint16_t latency, uint16_t timeout, uint16_t min_advertising_interval, uint16_t max_advertising_interval, int8_t tx_power);
+  const BLEConnectionParameters& get_connection_parameters(BLEConnectionProfile profile) const { return connection_parameters[static_cast<uint8_t>(profile)]; }
+  /// Switches the connection profile. Advertising picks it up right away, connections from the next connection on.
+  void set_connection_profile(BLEConnectionProfile profile);
+  BLEConnectionProfile get_connection_profile() const { return connection_profile; }
+
+  /// Sets the MTU offered to clients in the MTU exchange (pre-setup). The clients initiate the exchange.
+  void set_preferred_mtu(uint16_t mtu) { preferred_mtu = mtu; }
+  /// Sets the maximum payload of link layer packets requested from clients when they connect (pre-setup), 27 disables Data Length Extension.
+  void set_preferred_data_length(uint16_t data_length) { preferred_data_length = data_length; }
+  /// @return a copy of the state of all connections (like MTU and data length), e.g. to size batches for a specific client
+  vector<BLEConnectionContext> get_connections() const { return connections.get_connections(); }
+  /// @return the MTU negotiated with the given client (the default MTU if there is no such connection)
+  uint16_t get_mtu(uint16_t conn_id) const { return connections.get_mtu(conn_id); }
+
+  /// @return the smallest MTU negotiated with the connected clients (the default MTU if no client is connected)
+  uint16_t get_mtu() const;
+  /// @return the maximum size of the value of a notification, i.e. the MTU without the ATT header (opcode and handle)
+  size_t get_max_notification_size() const { return get_mtu() - 3; }
+
+  /**
+   * Sends the current value of the characteristic as notification to every client that has subscribed to it (every client if the characteristic has no 0x2902 descriptor).
+   * @param ignore_subscriptions if true, the notification is sent to every connected client
+   * @param statistics optional statistics of the caller that the notifications are added to (in addition to the controller-wide statistics)
+   * @return true if the notification has been sent to at least one client
+   */
+  bool notify(BLECharacteristic* characteristic, bool ignore_subscriptions = false, BLETrafficStatistics* statistics = nullptr);
+  /**
+   * Sends the current value of the characteristic as indication to every client that has subscribed to indications.
+   * Unlike BLECharacteristic::indicate() it does not wait for the confirmation of the client, so that the loop does not stall on a slow link (the stack queues further indications until the client confirms).
+   */
+  void indicate(BLECharacteristic* characteristic);
+  /// @return true if a notification of the characteristic would reach at least one client (see notify())
+  bool has_listeners(BLECharacteristic* characteristic, bool ignore_subscriptions = false) const;
 
 #ifdef USE_LOGGER
   int get_log_level() { return maintenance_handler->get_log_level(); }
@@ -97,45 +248,110 @@ public:
 
   void send_command_result(const string& result_message);
   void send_command_result(const char* result_msg_format, ...);
-
-  /// Executes a given function in the main loop of the app. (Can be called from another RTOS task.)
-  void execute_in_loop(std::function<void()>&& deferred_function);
+  /// Sends the result of an invocation of an asynchronous custom command, tagged with the invocation id.
+  void send_command_result(uint16_t invocation_id, const string& result_message) { maintenance_handler->send_command_result(invocation_id, result_message); }
+  void send_command_result(uint16_t invocation_id, const char* result_msg_format, ...);
+
+  /// Sets the maximum number of invocations of custom commands that may run at the same time.
+  void set_max_running_commands(size_t max_running) { maintenance_handler->set_max_running_commands(max_running); }
+  /// Sets the time after which a running invocation of a custom command no longer counts against the maximum (0 = never).
+  void set_command_timeout(uint32_t timeout_millis) { maintenance_handler->set_command_timeout(timeout_millis); }
+  uint16_t start_command_invocation(BLEControllerCustomCommandExecutionTrigger* trigger) { return maintenance_handler->start_command_invocation(trigger); }
+  void complete_command_invocation(uint16_t invocation_id) { maintenance_handler->complete_command_invocation(invocation_id); }
+  bool is_command_invocation_running(uint16_t invocation_id) const { return maintenance_handler->is_command_invocation_running(invocation_id); }
+
+  /**
+   * Executes a given function in the main loop of the app. (Can be called from another RTOS task, never blocks.)
+   * @param deferred_function the function to execute
+   * @param coalescing_key optional key, if the queue coalesces, the function is skipped while another function with the same key is still queued
+   */
+  void execute_in_loop(DeferredFunction&& deferred_function, const void* coalescing_key = nullptr);
+  /// Executes a given function object (like a lambda) in the main loop of the app without allocating memory. (Can be called from another RTOS task, never blocks.)
+  template <typename F> void execute_in_loop(F&& deferred_function, const void* coalescing_key = nullptr) {
+    execute_in_loop(DeferredFunction(std::forward<F>(deferred_function)), coalescing_key);
+  }
+  /// @return true if called from the task that runs the main loop of the app (and setup())
+  bool is_loop_task() const { return xTaskGetCurrentTaskHandle() == loop_task; }
+
+  const ThreadSafeBoundedQueue<DeferredFunction>& get_deferred_functions_queue() const { return deferred_functions_for_loop; }
+  const BLELoopStatistics& get_loop_statistics() const { return loop_statistics; }
+  void reset_loop_statistics() { loop_statistics = BLELoopStatistics(); }
+
+  /// @return the notifications sent by all characteristics (incl. the maintenance service)
+  const BLETrafficStatistics& get_traffic_statistics() const { return traffic_statistics; }
+  /// @return the handlers of all exposed components (incl. aggregates)
+  const vector<BLEComponentHandlerBase*>& get_handlers() const { return handlers; }
+  /// @return the sum of the statistics of all handlers
+  BLEHandlerStatistics get_handler_statistics_total() const;
+  /// Resets the traffic, handler, loop, and deferred functions queue statistics.
+  void reset_statistics();
 
 private:
+  /// A component registered to be exposed by a characteristic, the characteristic info resides in the generated constant table.
+  struct BLEComponentRegistration {
+    EntityBase* component;
+    BLEComponentKind kind;
+    const BLECharacteristicInfoForHandler* characteristic_info;
+  };
+
+  void register_component(EntityBase* component, BLEComponentKind kind, const BLECharacteristicInfoForHandler& characteristic_info);
+
   void initialize_ble_mode();
 
+  void execute_deferred_functions();
+
+  /// Runs the current setup phase (or a time slice of it) and advances to the next phase when it is complete.
+  void run_setup_phase();
   bool setup_ble();
-  void setup_ble_server_and_services();
-  void setup_ble_services_for_components();
-  template <typename C> void setup_ble_services_for_components(const vector<C*>& components, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&));
-  template <typename C> void setup_ble_service_for_component(C* component, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&));
-  template <typename C, typename S> void update_component_state(C* component, S state);
-
-  // Controller methods:
-  void register_state_change_callbacks_and_send_initial_states();
+  void setup_ble_device_and_server();
+  /// Sets up the characteristics of the next registered components until the time slice has elapsed, @return true when all components have been set up
+  bool setup_ble_services_for_components(uint32_t slice_start_us);
+  void setup_ble_service_for_registration(const BLEComponentRegistration& registration);
+  void setup_ble_services_for_aggregates();
+  void create_ble_services_for_components();
+  /// @return the (already created) service with the given UUID
+  BLEService* get_ble_service_for_component(const BLEUUIDBytes& service_UUID);
+  /// @return true if all services of the components have been started
+  bool start_ble_services_for_components(uint32_t slice_start_us);
+
+  /// Adds and removes services according to the given mode (after setup).
+  void apply_ble_mode(BLEMaintenanceMode mode);
+  /// Runs the setup phases again from the given phase on (for parts of the GATT table that have never been set up).
+  void restart_setup_phases(BLESetupPhase phase);
+  void add_component_services();
+  void remove_component_services();
+  void indicate_service_changed();
+  /// Sends the current value of the characteristic to the given clients without waiting for confirmations (see notify() and indicate()).
+  bool send_value_to_clients(BLECharacteristic* characteristic, const BLENotificationTarget* targets, size_t target_count, bool indication, BLETrafficStatistics* statistics);
+  void shut_down_ble();
+  void log_setup_durations();
+  template <typename C> void setup_ble_service_for_component(const BLEComponentRegistration& registration, BLEComponentHandlerBase* (*handler_creator)(C*, const BLECharacteristicInfoForHandler&));
+  void add_component_to_aggregate(const BLEComponentRegistration& registration);
+  template <typename C> void add_component_to_aggregate(C* component, BLEAggregateHandler* aggregate_handler);
+
 #ifdef USE_BINARY_SENSOR
-  void on_binary_sensor_update(binary_sensor::BinarySensor *obj, bool state);
+  void register_state_change_callback_and_send_initial_state(binary_sensor::BinarySensor* component, BLEComponentHandlerBase* handler);
 #endif
 #ifdef USE_FAN
-  void on_fan_update(fan::Fan *obj);
-#endif
-#ifdef USE_LIGHT
-  void on_light_update(light::LightState *obj);
+  void register_state_change_callback_and_send_initial_state(fan::Fan* component, BLEComponentHandlerBase* handler);
 #endif
 #ifdef USE_SENSOR
-  void on_sensor_update(sensor::Sensor *obj, float state);
+  void register_state_change_callback_and_send_initial_state(sensor::Sensor* component, BLEComponentHandlerBase* handler);
 #endif
 #ifdef USE_SWITCH
-  void on_switch_update(switch_::Switch *obj, bool state);
-#endif
-#ifdef USE_COVER
-  void on_cover_update(cover::Cover *obj);
+  void register_state_change_callback_and_send_initial_state(switch_::Switch* component, BLEComponentHandlerBase* handler);
 #endif
 #ifdef USE_TEXT_SENSOR
-  void on_text_sensor_update(text_sensor::TextSensor *obj, std::string state);
+  void register_state_change_callback_and_send_initial_state(text_sensor::TextSensor* component, BLEComponentHandlerBase* handler);
+#endif
+#ifdef USE_BINARY_SENSOR
+  void register_state_change_callback_and_send_initial_state(binary_sensor::BinarySensor* component, BLEAggregateHandler* handler, size_t index);
+#endif
+#ifdef USE_SENSOR
+  void register_state_change_callback_and_send_initial_state(sensor::Sensor* component, BLEAggregateHandler* handler, size_t index);
 #endif
-#ifdef USE_CLIMATE
-  void on_climate_update(climate::Climate *obj);
+#ifdef USE_SWITCH
+  void register_state_change_callback_and_send_initial_state(switch_::Switch* component, BLEAggregateHandler* handler, size_t index);
 #endif
 
   void configure_ble_security();
@@ -145,15 +361,40 @@ private:
   virtual void onAuthenticationComplete(esp_ble_auth_cmpl_t); // inherited from BLESecurityCallbacks
   virtual bool onConfirmPIN(uint32_t pin); // inherited from BLESecurityCallbacks
   
-  virtual void onConnect(BLEServer* server); // inherited from BLEServerCallbacks
-  virtual void onDisconnect(BLEServer* server); // inherited from BLEServerCallbacks
+  /// Continues advertising and calls the connected callbacks (in the loop) for an accepted connection.
+  void on_client_connected();
+  /// Restarts advertising and calls the disconnected callbacks (in the loop) for a connection that has been accepted.
+  void on_client_disconnected();
+
+  /// Keeps track of the connections, called for every GATT server event (in the BLE task).
+  void on_gatts_event(esp_gatts_cb_event_t event, esp_ble_gatts_cb_param_t* param);
+  /// Keeps track of the data length of the connections, called for every GAP event (in the BLE task).
+  void on_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param);
+
+  /// Applies advertising interval and transmit power of the current connection profile.
+  void apply_advertising_parameters();
+  /// Requests the connection parameters of the current connection profile from the client.
+  void request_connection_parameters(esp_bd_addr_t address);
 
 private:
-  BLEServer* ble_server;
+  BLEServer* ble_server{nullptr};
+  BLEConnectionRegistry connections;
+  /// read in the BLE task when a client connects
+  volatile BLEConnectionProfile connection_profile{BLEConnectionProfile::BALANCED};
+  BLEConnectionParameters connection_parameters[BLE_CONNECTION_PROFILE_COUNT];
+  uint16_t preferred_mtu{ESP_GATT_DEF_BLE_MTU_SIZE};
+  uint16_t preferred_data_length{BLE_DEFAULT_DATA_LENGTH};
 
   BLEMaintenanceMode initial_ble_mode_after_flashing{BLEMaintenanceMode::ALL};
   BLEMaintenanceMode ble_mode;
+  BLEMaintenanceMode requested_ble_mode;
   ESPPreferenceObject ble_mode_preference;
+  /// true while the BLE device and the server exist, i.e. from the setup phase DEVICE until BLE is shut down (never if BLE is inactive since boot)
+  bool ble_device_initialized{false};
+  /// true after BLE has been shut down at runtime, the BLE controller cannot be started again until reboot
+  bool ble_controller_memory_released{false};
+  /// task of the main loop, recorded in setup()
+  TaskHandle_t loop_task{nullptr};
 
   BLESecurityMode security_mode{BLESecurityMode::SECURE};
   bool can_show_pass_key{false};
@@ -164,10 +405,31 @@ private:
   WifiConfigurationHandler wifi_configuration_handler;
 #endif
 
-  unordered_map<string, BLECharacteristicInfoForHandler> info_for_component;
-  unordered_map<string, BLEComponentHandlerBase*> handler_for_component;
-
-  ThreadSafeBoundedQueue<std::function<void()>> deferred_functions_for_loop{16};
+  vector<BLEComponentRegistration> registrations;
+  vector<const BLEServiceInfo*> service_infos;
+  /// services of the components with their number of handles, in the order of creation
+  vector<pair<BLEService*, uint16_t>> component_services;
+  /// handlers of all exposed components (incl. aggregates)
+  vector<BLEComponentHandlerBase*> handlers;
+
+  BLESetupPhase setup_phase{BLESetupPhase::STACK};
+  /// time spent in each setup phase (in microseconds)
+  uint32_t setup_phase_durations_us[BLE_SETUP_PHASE_COUNT]{};
+  /// time from setup() until the setup phases have been completed (in milliseconds)
+  uint32_t setup_duration_millis{0};
+  uint32_t setup_start_millis{0};
+  /// index of the next registration to set up in phase COMPONENT_SERVICES
+  size_t next_registration{0};
+  /// aggregates collected in phase COMPONENT_SERVICES, set up in phase AGGREGATES
+  vector<BLEAggregateHandler*> aggregate_handlers;
+  /// index of the next service to start in phase COMPONENT_SERVICES_START
+  size_t next_service_to_start{0};
+
+  ThreadSafeBoundedQueue<DeferredFunction> deferred_functions_for_loop{16};
+  uint32_t loop_time_budget_us{0};
+  uint32_t loop_item_budget{0};
+  BLELoopStatistics loop_statistics;
+  BLETrafficStatistics traffic_statistics;
 
   CallbackManager<void(string)> on_show_pass_key_callbacks;
   CallbackManager<void(bool)>   on_authentication_complete_callbacks;
@@ -0,0 +1,43 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import CONF_ID, ENTITY_CATEGORY_DIAGNOSTIC, STATE_CLASS_MEASUREMENT, STATE_CLASS_TOTAL_INCREASING
+
+from . import esp32_ble_controller_ns
+
+DEPENDENCIES = ['esp32_ble_controller']
+
+BLEStatisticsSensors = esp32_ble_controller_ns.class_('BLEStatisticsSensors', cg.PollingComponent)
+
+CONF_NOTIFICATIONS = "notifications"
+CONF_BYTES_SENT = "bytes_sent"
+CONF_WRITES_RECEIVED = "writes_received"
+CONF_VALUES_SUPPRESSED = "values_suppressed"
+CONF_QUEUE_HIGH_WATER = "queue_high_water"
+CONF_QUEUE_DROPPED = "queue_dropped"
+
+# counters only increase (except for 'stats reset')
+COUNTER_SCHEMA = sensor.sensor_schema(accuracy_decimals=0, state_class=STATE_CLASS_TOTAL_INCREASING, entity_category=ENTITY_CATEGORY_DIAGNOSTIC)
+SENSORS = {
+    CONF_NOTIFICATIONS: COUNTER_SCHEMA,
+    CONF_BYTES_SENT: sensor.sensor_schema(unit_of_measurement="B", accuracy_decimals=0, state_class=STATE_CLASS_TOTAL_INCREASING, entity_category=ENTITY_CATEGORY_DIAGNOSTIC),
+    CONF_WRITES_RECEIVED: COUNTER_SCHEMA,
+    CONF_VALUES_SUPPRESSED: COUNTER_SCHEMA,
+    CONF_QUEUE_HIGH_WATER: sensor.sensor_schema(accuracy_decimals=0, state_class=STATE_CLASS_MEASUREMENT, entity_category=ENTITY_CATEGORY_DIAGNOSTIC),
+    CONF_QUEUE_DROPPED: COUNTER_SCHEMA,
+}
+
+CONFIG_SCHEMA = cv.Schema({
+    cv.GenerateID(): cv.declare_id(BLEStatisticsSensors),
+    **{cv.Optional(key): schema for key, schema in SENSORS.items()},
+}).extend(cv.polling_component_schema("60s"))
+
+def to_code(config):
+    """Generates the C++ code for the statistics sensors"""
+    var = cg.new_Pvariable(config[CONF_ID])
+    yield cg.register_component(var, config)
+
+    for key in SENSORS:
+        if key in config:
+            sens = yield sensor.new_sensor(config[key])
+            cg.add(getattr(var, "set_%s_sensor" % key)(sens))
@@ -1,26 +1,62 @@
 #pragma once
 
-#include <freertos/FreeRTOS.h>
-#include <freertos/queue.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
 
 namespace esphome {
 namespace esp32_ble_controller {
 
+/// Determines what happens when an object is pushed into a full ThreadSafeBoundedQueue.
+enum class QueueOverflowPolicy : uint8_t {
+  /// the pushed object is dropped
+  DROP_NEWEST,
+  /// the oldest queued object is dropped to make room for the pushed object
+  DROP_OLDEST,
+  /// objects pushed with a key are dropped while another object with the same key is still queued; otherwise like DROP_NEWEST
+  COALESCE,
+};
+
 /**
- * Thread-safe non-blocking bounded queue to pass values between Free RTOS tasks.
+ * Thread-safe non-blocking bounded queue to pass values between Free RTOS tasks (multiple producers, single consumer).
+ * All slots for the queued objects are allocated once upfront, so pushing and taking objects does not allocate any memory.
+ * The queue is lock-free (a ring of slots with per-slot sequence numbers), so pushing never blocks the calling task, not even when the queue is full.
+ * <para>
+ * Objects are consumed by a single task. Taking an object is nevertheless safe for concurrent takers (the dequeue position is claimed by CAS like the
+ * enqueue position), which the DROP_OLDEST policy relies on: a producer that finds the queue full discards the oldest object itself.
  */
 template <typename T>
 class ThreadSafeBoundedQueue {
+  /// results of mark_key_as_queued()
+  static const int KEY_MARKED = 0;
+  static const int KEY_QUEUED = 1;
+  static const int KEY_NOT_TRACKED = 2;
+
 public:
-  /// Creates a bounded queue with the given size (i.e. maximum number of objects that can be queued).
-  ThreadSafeBoundedQueue(unsigned int size);
+  /// Creates a bounded queue with the given size (i.e. maximum number of objects that can be queued), which is rounded up to a power of 2.
+  ThreadSafeBoundedQueue(unsigned int size, QueueOverflowPolicy overflow_policy = QueueOverflowPolicy::DROP_NEWEST);
+  ~ThreadSafeBoundedQueue();
+
+  ThreadSafeBoundedQueue(const ThreadSafeBoundedQueue&) = delete;
+  ThreadSafeBoundedQueue& operator=(const ThreadSafeBoundedQueue&) = delete;
+
+  /**
+   * Changes the size of the queue; all queued objects are discarded.
+   * Note: Must only be called before the queue is used (typically during configuration).
+   */
+  void set_size(unsigned int size);
+  void set_overflow_policy(QueueOverflowPolicy policy) { overflow_policy = policy; }
+  QueueOverflowPolicy get_overflow_policy() const { return overflow_policy; }
 
   /**
    * Pushes the given object into the queue, the queue takes over ownership.
    * @param object object to append to the queue (treated as r-value)
-   * @return true if successful, false if queue is full
+   * @param key optional key identifying objects that are interchangeable, only relevant for the COALESCE overflow policy
+   * @return true if successful (or coalesced with a queued object), false if the object was dropped
    */
-  bool push(T&& object);
+  bool push(T&& object, const void* key = nullptr);
 
   /**
    * Takes the first queued element from the queue (if any) and moves it to the given object.
@@ -29,37 +65,245 @@ public:
    */
   bool take(T& object);
 
+  size_t get_capacity() const { return mask + 1; }
+  /// @return the number of queued objects (approximation if other tasks are pushing or taking at the same time)
+  size_t size() const;
+
+  /// @return the number of objects that were dropped because the queue was full
+  uint32_t get_dropped_count() const { return dropped_count.load(std::memory_order_relaxed); }
+  /// @return the number of objects that were coalesced with an already queued object
+  uint32_t get_coalesced_count() const { return coalesced_count.load(std::memory_order_relaxed); }
+  /// @return the maximum number of objects that have been queued at the same time
+  size_t get_high_water_mark() const { return high_water_mark.load(std::memory_order_relaxed); }
+  void reset_statistics();
+
 private:
-  QueueHandle_t queue;
+  struct Slot {
+    std::atomic<size_t> sequence;
+    const void* key;
+    T object;
+  };
+
+  void allocate(unsigned int size);
+  bool try_push(T& object, const void* key);
+  bool try_take(T& object, const void*& key);
+
+  /// @return the entry of the table of queued keys that the given key maps to
+  std::atomic<const void*>& get_key_entry(const void* key) const;
+  /// Marks the given key as queued. @return KEY_QUEUED if it was already queued, KEY_NOT_TRACKED if its entry is taken by another key
+  int mark_key_as_queued(const void* key);
+  void unmark_key_as_queued(const void* key);
+
+  void update_high_water_mark();
+
+  Slot* slots{nullptr};
+  size_t mask{0};
+  /// keys of queued objects by hash (only used for the COALESCE policy), nullptr marks an unused entry
+  std::atomic<const void*>* queued_keys{nullptr};
+  size_t queued_keys_mask{0};
+  QueueOverflowPolicy overflow_policy;
+
+  std::atomic<size_t> enqueue_position{0};
+  std::atomic<size_t> dequeue_position{0};
+
+  std::atomic<uint32_t> dropped_count{0};
+  std::atomic<uint32_t> coalesced_count{0};
+  std::atomic<size_t> high_water_mark{0};
 };
 
 template <typename T>
-ThreadSafeBoundedQueue<T>::ThreadSafeBoundedQueue(unsigned int size) {
-  queue = xQueueCreate( size, sizeof( void* ) );
+ThreadSafeBoundedQueue<T>::ThreadSafeBoundedQueue(unsigned int size, QueueOverflowPolicy overflow_policy) : overflow_policy(overflow_policy) {
+  allocate(size);
+}
+
+template <typename T>
+ThreadSafeBoundedQueue<T>::~ThreadSafeBoundedQueue() {
+  delete[] slots;
+  delete[] queued_keys;
 }
 
 template <typename T>
-bool ThreadSafeBoundedQueue<T>::push(T&& object) {
-  T* pointer_to_copy = new T();
-  *pointer_to_copy = std::move(object);
+void ThreadSafeBoundedQueue<T>::set_size(unsigned int size) {
+  delete[] slots;
+  delete[] queued_keys;
+  allocate(size);
+}
+
+template <typename T>
+void ThreadSafeBoundedQueue<T>::allocate(unsigned int size) {
+  size_t capacity = 1;
+  while (capacity < size) {
+    capacity <<= 1;
+  }
+
+  slots = new Slot[capacity];
+  for (size_t i = 0; i < capacity; ++i) {
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+    slots[i].key = nullptr;
+  }
+  mask = capacity - 1;
+
+  // twice as many entries as slots keeps collisions of keys rare
+  queued_keys = new std::atomic<const void*>[2 * capacity];
+  for (size_t i = 0; i < 2 * capacity; ++i) {
+    queued_keys[i].store(nullptr, std::memory_order_relaxed);
+  }
+  queued_keys_mask = 2 * capacity - 1;
 
-  // add the pointer to the queue, not the object itself
-  auto result = xQueueSend(queue, &pointer_to_copy, 20L / portTICK_PERIOD_MS);
-  return result == pdPASS;
+  enqueue_position.store(0, std::memory_order_relaxed);
+  dequeue_position.store(0, std::memory_order_relaxed);
+  reset_statistics();
+}
+
+template <typename T>
+bool ThreadSafeBoundedQueue<T>::push(T&& object, const void* key) {
+  if (overflow_policy != QueueOverflowPolicy::COALESCE) {
+    key = nullptr;
+  } else if (key != nullptr) {
+    const int marked = mark_key_as_queued(key);
+    if (marked == KEY_QUEUED) {
+      coalesced_count.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    } else if (marked == KEY_NOT_TRACKED) {
+      key = nullptr; // queued without coalescing
+    }
+  }
+
+  bool pushed = try_push(object, key);
+  if (!pushed && overflow_policy == QueueOverflowPolicy::DROP_OLDEST) {
+    // make room by discarding the oldest object (another producer may grab the free slot first, so we try only once)
+    T oldest;
+    const void* oldest_key;
+    if (try_take(oldest, oldest_key)) {
+      if (oldest_key != nullptr) {
+        unmark_key_as_queued(oldest_key);
+      }
+      dropped_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    pushed = try_push(object, key);
+  }
+
+  if (pushed) {
+    update_high_water_mark();
+  } else {
+    if (key != nullptr) {
+      unmark_key_as_queued(key);
+    }
+    dropped_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  return pushed;
 }
 
 template <typename T>
 bool ThreadSafeBoundedQueue<T>::take(T& object) {
-  T* pointer_to_object; 
-  auto result = xQueueReceive(queue, &pointer_to_object, 0);
-  if (result != pdPASS) {
+  const void* key;
+  if (!try_take(object, key)) {
     return false;
   }
 
-  object = std::move(*pointer_to_object);
-  delete pointer_to_object;
+  // The key is released before the object is processed, so objects pushed from now on are queued again.
+  if (key != nullptr) {
+    unmark_key_as_queued(key);
+  }
   return true;
 }
 
+template <typename T>
+bool ThreadSafeBoundedQueue<T>::try_push(T& object, const void* key) {
+  Slot* slot;
+  size_t position = enqueue_position.load(std::memory_order_relaxed);
+  for (;;) {
+    slot = &slots[position & mask];
+    const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+    if (difference == 0) {
+      if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (difference < 0) {
+      return false; // full
+    } else {
+      position = enqueue_position.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->object = std::move(object);
+  slot->key = key;
+  slot->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+bool ThreadSafeBoundedQueue<T>::try_take(T& object, const void*& key) {
+  Slot* slot;
+  size_t position = dequeue_position.load(std::memory_order_relaxed);
+  for (;;) {
+    slot = &slots[position & mask];
+    const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+    if (difference == 0) {
+      if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (difference < 0) {
+      return false; // empty
+    } else {
+      position = dequeue_position.load(std::memory_order_relaxed);
+    }
+  }
+
+  object = std::move(slot->object);
+  key = slot->key;
+  slot->sequence.store(position + mask + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+std::atomic<const void*>& ThreadSafeBoundedQueue<T>::get_key_entry(const void* key) const {
+  // Fibonacci hashing of the address (the low bits are always zero due to alignment)
+  const uint32_t hash = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(key) >> 2) * 2654435769u;
+  return queued_keys[hash & queued_keys_mask];
+}
+
+template <typename T>
+int ThreadSafeBoundedQueue<T>::mark_key_as_queued(const void* key) {
+  // A single CAS claims the key, so two producers cannot both queue it. A key whose entry is taken by another key is not coalesced.
+  const void* expected = nullptr;
+  if (get_key_entry(key).compare_exchange_strong(expected, key, std::memory_order_acq_rel)) {
+    return KEY_MARKED;
+  }
+  return expected == key ? KEY_QUEUED : KEY_NOT_TRACKED;
+}
+
+template <typename T>
+void ThreadSafeBoundedQueue<T>::unmark_key_as_queued(const void* key) {
+  const void* expected = key;
+  get_key_entry(key).compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+}
+
+template <typename T>
+size_t ThreadSafeBoundedQueue<T>::size() const {
+  // the dequeue position never passes the enqueue position, so reading it first cannot yield a negative size
+  const size_t dequeued = dequeue_position.load(std::memory_order_acquire);
+  const size_t enqueued = enqueue_position.load(std::memory_order_acquire);
+  // both positions may have advanced a lot between the two loads
+  return std::min<size_t>(enqueued - dequeued, mask + 1);
+}
+
+template <typename T>
+void ThreadSafeBoundedQueue<T>::update_high_water_mark() {
+  const size_t current_size = size();
+  size_t current_high_water_mark = high_water_mark.load(std::memory_order_relaxed);
+  while (current_size > current_high_water_mark && !high_water_mark.compare_exchange_weak(current_high_water_mark, current_size, std::memory_order_relaxed)) {
+  }
+}
+
+template <typename T>
+void ThreadSafeBoundedQueue<T>::reset_statistics() {
+  dropped_count.store(0, std::memory_order_relaxed);
+  coalesced_count.store(0, std::memory_order_relaxed);
+  high_water_mark.store(size(), std::memory_order_relaxed);
+}
+
 } // namespace esp32_ble_controller
 } // namespace esphome
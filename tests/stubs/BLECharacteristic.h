@@ -0,0 +1,17 @@
+#pragma once
+
+// host replacement of the characteristic of the ESP32 BLE library, it only holds its value
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class BLECharacteristic {
+public:
+  void setValue(uint8_t* data, size_t size) { value.assign(reinterpret_cast<const char*>(data), size); }
+  void setValue(const std::string& value) { this->value = value; }
+  std::string getValue() { return value; }
+
+private:
+  std::string value;
+};
@@ -0,0 +1,6 @@
+#pragma once
+
+// host replacement of the ESP-IDF GATT definitions (only what the tested sources use)
+
+#define ESP_GATT_DEF_BLE_MTU_SIZE 23
+#define ESP_GATT_MAX_MTU_SIZE 517
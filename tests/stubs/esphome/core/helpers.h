@@ -0,0 +1,27 @@
+#pragma once
+
+// host replacement of esphome/core/helpers.h (only what the tested sources use)
+
+#include <mutex>
+
+namespace esphome {
+
+class Mutex {
+public:
+  void lock() { mutex.lock(); }
+  void unlock() { mutex.unlock(); }
+
+private:
+  std::mutex mutex;
+};
+
+class LockGuard {
+public:
+  LockGuard(Mutex& mutex) : mutex(mutex) { mutex.lock(); }
+  ~LockGuard() { mutex.unlock(); }
+
+private:
+  Mutex& mutex;
+};
+
+} // namespace esphome
@@ -0,0 +1,11 @@
+#pragma once
+
+// host replacement of esphome/core/log.h, log output is discarded
+
+#define ESP_LOG_DISCARD(tag, ...) do { (void) (tag); } while (0)
+#define ESP_LOGE(tag, ...) ESP_LOG_DISCARD(tag)
+#define ESP_LOGW(tag, ...) ESP_LOG_DISCARD(tag)
+#define ESP_LOGI(tag, ...) ESP_LOG_DISCARD(tag)
+#define ESP_LOGD(tag, ...) ESP_LOG_DISCARD(tag)
+#define ESP_LOGV(tag, ...) ESP_LOG_DISCARD(tag)
+#define ESP_LOGCONFIG(tag, ...) ESP_LOG_DISCARD(tag)
@@ -0,0 +1,132 @@
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ble_log_buffer.h"
+
+using namespace esphome::esp32_ble_controller;
+
+static std::string take_line(BLELogBuffer& buffer) {
+  std::string line;
+  assert(buffer.take(line));
+  return line;
+}
+
+static void test_magic_symbols_and_header() {
+  BLELogBuffer buffer;
+  buffer.set_capacity(64);
+
+  // many rounds, so that lines wrap around the end of the buffer
+  for (int round = 0; round < 20; ++round) {
+    assert(buffer.add_log_message("\033[0;36m[D][sensor:125]: x\033[0m", 5, "sensor", false));
+    assert(take_line(buffer) == "[D][sensor:125]: x");
+
+    // binary prefix: level, length of the tag, tag, message without header
+    assert(buffer.add_log_message("\033[0;36m[D][sensor:125]: 'a': b\033[0m", 5, "sensor", true));
+    assert(take_line(buffer) == std::string("\x05\x06sensor'a': b", 14));
+
+    // a message without header is passed in full
+    assert(buffer.add_log_message("abc", 3, "t", true));
+    assert(take_line(buffer) == std::string("\x03\x01tabc", 6));
+  }
+}
+
+static void test_lines_are_taken_in_order() {
+  BLELogBuffer buffer;
+  buffer.set_capacity(64);
+  size_t length;
+  assert(!buffer.peek_length(length));
+
+  assert(buffer.add_log_message("first", 3, "t", false));
+  assert(buffer.add_log_message("second", 3, "t", false));
+  assert(buffer.peek_length(length) && length == 5);
+
+  // take() appends to the given string
+  std::string lines = "> ";
+  assert(buffer.take(lines));
+  assert(buffer.take(lines));
+  assert(lines == "> firstsecond");
+  std::string line;
+  assert(!buffer.take(line));
+}
+
+static void test_full_buffer_drops_lines() {
+  BLELogBuffer buffer;
+  buffer.set_capacity(16);
+
+  assert(buffer.add_log_message("0123456789", 3, "t", false)); // 12 bytes with length prefix
+  assert(!buffer.add_log_message("abc", 3, "t", false));
+  assert(buffer.get_dropped_count() == 1);
+  // lines longer than the buffer never fit
+  assert(!buffer.add_log_message("0123456789abcdefghij", 3, "t", false));
+  assert(buffer.get_dropped_count() == 2);
+
+  assert(take_line(buffer) == "0123456789");
+  assert(buffer.add_log_message("abc", 3, "t", false));
+  assert(take_line(buffer) == "abc");
+}
+
+static void test_concurrent_loggers() {
+  const int logger_count = 4;
+  const int lines_per_logger = 5000;
+
+  BLELogBuffer buffer;
+  buffer.set_capacity(256);
+  std::atomic<bool> loggers_done{false};
+  std::vector<std::string> lines;
+
+  std::thread consumer([&]() {
+    std::string line;
+    for (;;) {
+      line.clear();
+      if (buffer.take(line)) {
+        lines.push_back(line);
+      } else if (loggers_done.load()) {
+        while (buffer.take(line)) {
+          lines.push_back(line);
+          line.clear();
+        }
+        return;
+      }
+    }
+  });
+
+  std::vector<std::thread> loggers;
+  for (int logger = 0; logger < logger_count; ++logger) {
+    loggers.emplace_back([&buffer, logger]() {
+      for (int i = 0; i < lines_per_logger; ++i) {
+        const std::string message = "[D][logger:1]: " + std::to_string(logger) + " " + std::to_string(i);
+        buffer.add_log_message(message.c_str(), 5, "logger", false);
+      }
+    });
+  }
+  for (auto& logger : loggers) {
+    logger.join();
+  }
+  loggers_done.store(true);
+  consumer.join();
+
+  assert(lines.size() + buffer.get_dropped_count() == logger_count * lines_per_logger);
+  // every line is complete, and the lines of each logger are in order
+  std::vector<int> last_index(logger_count, -1);
+  for (const auto& line : lines) {
+    int logger, index;
+    assert(sscanf(line.c_str(), "[D][logger:1]: %d %d", &logger, &index) == 2);
+    assert(line == "[D][logger:1]: " + std::to_string(logger) + " " + std::to_string(index));
+    assert(index > last_index[logger]);
+    last_index[logger] = index;
+  }
+}
+
+int main() {
+  test_magic_symbols_and_header();
+  test_lines_are_taken_in_order();
+  test_full_buffer_drops_lines();
+  test_concurrent_loggers();
+
+  printf("ble_log_buffer: ok\n");
+  return 0;
+}
@@ -0,0 +1,146 @@
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <esp_gatt_defs.h>
+
+#include "ble_message_framer.h"
+
+namespace esphome {
+namespace esp32_ble_controller {
+
+struct SentFragment {
+  std::string value;
+  bool indication;
+};
+
+static std::vector<SentFragment> sent_fragments;
+
+// replaces the controller, which sends the fragments to the clients
+void send_fragment_to_clients(BLECharacteristic* characteristic, bool indication) {
+  sent_fragments.push_back({ characteristic->getValue(), indication });
+}
+
+} // namespace esp32_ble_controller
+} // namespace esphome
+
+using namespace esphome::esp32_ble_controller;
+
+/// Reassembles the sent fragments like a client, checking sequence numbers, flags and sizes.
+static std::vector<std::string> reassemble(size_t max_fragment_size) {
+  std::vector<std::string> messages;
+  std::string message;
+  bool within_message = false;
+  int last_sequence = -1;
+
+  for (const auto& fragment : sent_fragments) {
+    const std::string& value = fragment.value;
+    assert(value.size() >= BLE_FRAGMENT_HEADER_SIZE && value.size() <= max_fragment_size);
+    const uint8_t sequence = value[0];
+    const uint8_t flags = value[1];
+    if (last_sequence >= 0) {
+      assert(sequence == static_cast<uint8_t>(last_sequence + 1));
+    }
+    last_sequence = sequence;
+
+    assert(((flags & BLE_FRAGMENT_FLAG_FIRST) != 0) == !within_message);
+    if (flags & BLE_FRAGMENT_FLAG_FIRST) {
+      message.clear();
+    }
+    message += value.substr(BLE_FRAGMENT_HEADER_SIZE);
+    within_message = (flags & BLE_FRAGMENT_FLAG_MORE) != 0;
+    if (!within_message) {
+      messages.push_back(message);
+    }
+  }
+  assert(!within_message);
+  return messages;
+}
+
+static std::string make_message(size_t length) {
+  std::string message(length, ' ');
+  for (size_t i = 0; i < length; ++i) {
+    message[i] = 'a' + i % 26;
+  }
+  return message;
+}
+
+static void test_queued_messages() {
+  sent_fragments.clear();
+  BLEMessageFramer framer;
+  BLECharacteristic characteristic;
+  const std::string long_message = make_message(1000);
+  const std::vector<std::string> messages = { "hi", long_message, "", make_message(18) };
+  for (const auto& message : messages) {
+    assert(framer.add_message(message));
+  }
+
+  // at most 4 fragments per call
+  size_t calls = 0;
+  while (framer.has_fragments()) {
+    const size_t sent_before = sent_fragments.size();
+    framer.send_fragments(&characteristic, 20, 4);
+    assert(sent_fragments.size() - sent_before <= 4);
+    ++calls;
+  }
+  // 1000 bytes in fragments of 18, and one fragment each for the other messages
+  assert(sent_fragments.size() == 56 + 3);
+  assert(calls == (56 + 3 + 3) / 4);
+  assert(reassemble(20) == messages);
+  assert(!sent_fragments[0].indication);
+}
+
+static void test_immediate_message() {
+  sent_fragments.clear();
+  BLEMessageFramer framer;
+  framer.set_use_indications(true);
+  BLECharacteristic characteristic;
+
+  const std::string message = make_message(600);
+  // larger fragments than a notification can hold are cut to the maximum MTU
+  framer.send_message(&characteristic, 1000, message);
+  assert(reassemble(ESP_GATT_MAX_MTU_SIZE) == std::vector<std::string>{ message });
+  assert(sent_fragments.size() == 2);
+  assert(sent_fragments[0].indication);
+}
+
+static void test_sequence_wraps_around() {
+  sent_fragments.clear();
+  BLEMessageFramer framer;
+  BLECharacteristic characteristic;
+  const std::string message = make_message(300 * 18);
+  framer.send_message(&characteristic, 20, message);
+  assert(sent_fragments.size() == 300);
+  assert(reassemble(20) == std::vector<std::string>{ message });
+}
+
+static void test_full_queue_drops_messages() {
+  sent_fragments.clear();
+  BLEMessageFramer framer;
+  for (size_t i = 0; i < BLE_FRAMER_MAX_QUEUED_MESSAGES; ++i) {
+    assert(framer.add_message(std::to_string(i)));
+  }
+  assert(!framer.add_message("dropped"));
+  assert(framer.get_dropped_count() == 1);
+
+  BLECharacteristic characteristic;
+  framer.send_fragments(&characteristic, 20, 1);
+  assert(framer.add_message("queued"));
+  while (framer.has_fragments()) {
+    framer.send_fragments(&characteristic, 20, 100);
+  }
+  const std::vector<std::string> messages = reassemble(20);
+  assert(messages.size() == BLE_FRAMER_MAX_QUEUED_MESSAGES + 1);
+  assert(messages.back() == "queued");
+}
+
+int main() {
+  test_queued_messages();
+  test_immediate_message();
+  test_sequence_wraps_around();
+  test_full_queue_drops_messages();
+
+  printf("ble_message_framer: ok\n");
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <utility>
+
+#include "deferred_function.h"
+#include "thread_safe_bounded_queue.h"
+
+using namespace esphome::esp32_ble_controller;
+
+/// Function object that counts its live instances, so that leaks and double destruction show up.
+struct CountedFunction {
+  static int instances;
+  int* calls;
+
+  explicit CountedFunction(int* calls) : calls(calls) { ++instances; }
+  CountedFunction(const CountedFunction& other) : calls(other.calls) { ++instances; }
+  CountedFunction(CountedFunction&& other) : calls(other.calls) { ++instances; }
+  ~CountedFunction() { --instances; }
+
+  void operator()() { ++*calls; }
+};
+
+int CountedFunction::instances = 0;
+
+static void test_empty() {
+  DeferredFunction function;
+  assert(!function);
+  function.reset();
+  assert(!function);
+}
+
+static void test_call() {
+  int calls = 0;
+  DeferredFunction function([&calls]() { ++calls; });
+  assert(function);
+  function();
+  function();
+  assert(calls == 2);
+}
+
+static void test_captured_string_fits_and_survives_moves() {
+  int* pointer = nullptr;
+  std::string result;
+  const std::string message(100, 'x'); // longer than any small string optimization
+  auto lambda = [pointer, &result, message]() { result = message; (void) pointer; };
+  static_assert(sizeof(lambda) <= DeferredFunction::INLINE_STORAGE_SIZE, "two pointers and a string must fit");
+
+  DeferredFunction function(std::move(lambda));
+  DeferredFunction moved(std::move(function));
+  assert(!function);
+
+  DeferredFunction assigned;
+  assigned = std::move(moved);
+  assert(!moved);
+  assigned();
+  assert(result == message);
+}
+
+static void test_instances_are_destroyed() {
+  int calls = 0;
+  {
+    DeferredFunction function{CountedFunction(&calls)};
+    assert(CountedFunction::instances == 1);
+
+    DeferredFunction moved(std::move(function));
+    assert(CountedFunction::instances == 1);
+
+    // assigning destroys the previous function object
+    DeferredFunction other{CountedFunction(&calls)};
+    assert(CountedFunction::instances == 2);
+    other = std::move(moved);
+    assert(CountedFunction::instances == 1);
+    other();
+    assert(calls == 1);
+
+    other.reset();
+    assert(CountedFunction::instances == 0);
+
+    DeferredFunction kept{CountedFunction(&calls)};
+    assert(CountedFunction::instances == 1);
+  }
+  assert(CountedFunction::instances == 0);
+}
+
+static void test_queued_functions() {
+  // the controller passes deferred functions through the bounded queue
+  ThreadSafeBoundedQueue<DeferredFunction> queue(4, QueueOverflowPolicy::DROP_OLDEST);
+  int calls = 0;
+  std::string log;
+  for (int i = 0; i < 6; ++i) {
+    assert(queue.push(DeferredFunction([&log, i]() { log += std::to_string(i); })));
+  }
+  assert(queue.push(CountedFunction(&calls)));
+  assert(CountedFunction::instances == 1);
+
+  DeferredFunction function;
+  while (queue.take(function)) {
+    function();
+  }
+  function.reset();
+  assert(log == "345");
+  assert(calls == 1);
+  assert(CountedFunction::instances == 0);
+}
+
+int main() {
+  test_empty();
+  test_call();
+  test_captured_string_fits_and_survives_moves();
+  test_instances_are_destroyed();
+  test_queued_functions();
+
+  printf("deferred_function: ok\n");
+  return 0;
+}
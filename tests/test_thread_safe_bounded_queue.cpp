@@ -0,0 +1,215 @@
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "thread_safe_bounded_queue.h"
+
+using namespace esphome::esp32_ble_controller;
+
+static void test_size_is_rounded_up_to_power_of_two() {
+  ThreadSafeBoundedQueue<uint32_t> queue(5);
+  assert(queue.get_capacity() == 8);
+  queue.set_size(16);
+  assert(queue.get_capacity() == 16);
+}
+
+static void test_objects_are_taken_in_order() {
+  ThreadSafeBoundedQueue<uint32_t> queue(4);
+  uint32_t value;
+  assert(!queue.take(value));
+
+  for (uint32_t i = 1; i <= 3; ++i) {
+    assert(queue.push(uint32_t(i)));
+  }
+  assert(queue.size() == 3);
+  for (uint32_t i = 1; i <= 3; ++i) {
+    assert(queue.take(value) && value == i);
+  }
+  assert(!queue.take(value));
+  assert(queue.get_high_water_mark() == 3);
+}
+
+static void test_drop_newest() {
+  ThreadSafeBoundedQueue<uint32_t> queue(4, QueueOverflowPolicy::DROP_NEWEST);
+  for (uint32_t i = 1; i <= 4; ++i) {
+    assert(queue.push(uint32_t(i)));
+  }
+  assert(!queue.push(5));
+  assert(queue.get_dropped_count() == 1);
+
+  uint32_t value;
+  assert(queue.take(value) && value == 1);
+  assert(queue.push(6));
+  for (uint32_t expected : { 2, 3, 4, 6 }) {
+    assert(queue.take(value) && value == expected);
+  }
+}
+
+static void test_drop_oldest() {
+  ThreadSafeBoundedQueue<uint32_t> queue(4, QueueOverflowPolicy::DROP_OLDEST);
+  for (uint32_t i = 1; i <= 6; ++i) {
+    assert(queue.push(uint32_t(i)));
+  }
+  assert(queue.get_dropped_count() == 2);
+
+  uint32_t value;
+  for (uint32_t expected : { 3, 4, 5, 6 }) {
+    assert(queue.take(value) && value == expected);
+  }
+  assert(!queue.take(value));
+}
+
+static void test_coalesce() {
+  int first_key, second_key;
+  ThreadSafeBoundedQueue<uint32_t> queue(4, QueueOverflowPolicy::COALESCE);
+  assert(queue.push(1, &first_key));
+  assert(queue.push(2, &first_key)); // coalesced with the queued object
+  assert(queue.push(3, &second_key));
+  assert(queue.push(4)); // objects without key are never coalesced
+  assert(queue.push(5));
+  assert(queue.size() == 4);
+  assert(queue.get_coalesced_count() == 1);
+
+  uint32_t value;
+  assert(queue.take(value) && value == 1);
+  // the key has been released when its object was taken
+  assert(queue.push(6, &first_key));
+  assert(queue.get_coalesced_count() == 1);
+
+  // full: an object with a queued key is still coalesced, others are dropped
+  assert(queue.push(7, &second_key));
+  assert(queue.get_coalesced_count() == 2);
+  int third_key;
+  assert(!queue.push(8, &third_key));
+  assert(queue.get_dropped_count() == 1);
+  // the key of the dropped object is not left marked as queued
+  assert(queue.take(value) && value == 3);
+  assert(queue.push(9, &third_key));
+  assert(queue.get_coalesced_count() == 2);
+}
+
+static void test_other_policies_ignore_keys() {
+  int key;
+  ThreadSafeBoundedQueue<uint32_t> queue(4, QueueOverflowPolicy::DROP_NEWEST);
+  assert(queue.push(1, &key));
+  assert(queue.push(2, &key));
+  assert(queue.size() == 2);
+  assert(queue.get_coalesced_count() == 0);
+}
+
+static void test_reset_statistics() {
+  ThreadSafeBoundedQueue<uint32_t> queue(2);
+  queue.push(1);
+  queue.push(2);
+  queue.push(3);
+  assert(queue.get_dropped_count() == 1 && queue.get_high_water_mark() == 2);
+
+  uint32_t value;
+  queue.take(value);
+  queue.reset_statistics();
+  assert(queue.get_dropped_count() == 0);
+  assert(queue.get_high_water_mark() == 1); // the objects still queued
+}
+
+/**
+ * Several producers push numbered objects into a small queue while a consumer takes them.
+ * Every object must be taken, dropped or coalesced exactly once, and the objects of each producer must arrive in order.
+ */
+static void run_producers_and_consumer(QueueOverflowPolicy policy) {
+  const uint32_t producer_count = 4;
+  const uint32_t objects_per_producer = 20000;
+  const size_t key_count = 8;
+
+  ThreadSafeBoundedQueue<uint32_t> queue(16, policy);
+  int keys[producer_count][key_count];
+  std::atomic<uint32_t> push_failures{0};
+  std::atomic<bool> producers_done{false};
+
+  std::vector<uint32_t> taken;
+  std::thread consumer([&]() {
+    uint32_t value;
+    for (;;) {
+      if (queue.take(value)) {
+        taken.push_back(value);
+      } else if (producers_done.load()) {
+        while (queue.take(value)) {
+          taken.push_back(value);
+        }
+        return;
+      }
+    }
+  });
+
+  std::vector<std::thread> producers;
+  for (uint32_t producer = 0; producer < producer_count; ++producer) {
+    producers.emplace_back([&, producer]() {
+      for (uint32_t i = 0; i < objects_per_producer; ++i) {
+        // every other object has a key, which is only relevant for COALESCE
+        const void* key = (i % 2 == 0) ? &keys[producer][i % key_count] : nullptr;
+        if (!queue.push((producer << 16) | i, key)) {
+          push_failures.fetch_add(1);
+        }
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  producers_done.store(true);
+  consumer.join();
+
+  const uint32_t total = producer_count * objects_per_producer;
+  assert(taken.size() + queue.get_dropped_count() + queue.get_coalesced_count() == total);
+  if (policy != QueueOverflowPolicy::DROP_OLDEST) {
+    assert(push_failures.load() == queue.get_dropped_count());
+  }
+  if (policy != QueueOverflowPolicy::COALESCE) {
+    assert(queue.get_coalesced_count() == 0);
+  }
+  assert(queue.size() == 0);
+  assert(queue.get_high_water_mark() <= queue.get_capacity());
+
+  std::vector<int64_t> last_index(producer_count, -1);
+  for (const uint32_t value : taken) {
+    const uint32_t producer = value >> 16;
+    const int64_t index = value & 0xFFFF;
+    assert(producer < producer_count);
+    assert(index > last_index[producer]);
+    last_index[producer] = index;
+  }
+
+  // no key is left marked as queued
+  if (policy == QueueOverflowPolicy::COALESCE) {
+    const uint32_t coalesced = queue.get_coalesced_count();
+    for (uint32_t producer = 0; producer < producer_count; ++producer) {
+      for (size_t key = 0; key < key_count; ++key) {
+        uint32_t value;
+        assert(queue.push(0, &keys[producer][key]));
+        assert(queue.take(value));
+      }
+    }
+    assert(queue.get_coalesced_count() == coalesced);
+  }
+}
+
+int main() {
+  test_size_is_rounded_up_to_power_of_two();
+  test_objects_are_taken_in_order();
+  test_drop_newest();
+  test_drop_oldest();
+  test_coalesce();
+  test_other_policies_ignore_keys();
+  test_reset_statistics();
+
+  for (auto policy : { QueueOverflowPolicy::DROP_NEWEST, QueueOverflowPolicy::DROP_OLDEST, QueueOverflowPolicy::COALESCE }) {
+    for (int run = 0; run < 5; ++run) {
+      run_producers_and_consumer(policy);
+    }
+  }
+
+  printf("thread_safe_bounded_queue: ok\n");
+  return 0;
+}